@@ -0,0 +1,172 @@
+/* bench.c - frame timing over a scripted flight
+ * Copyright (C) 2010 Michal Trybus.
+ *
+ * This file is part of FreeCG.
+ *
+ * FreeCG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeCG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeCG. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bench.h"
+#include "graphics.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL2/SDL.h>
+
+/* from the view of the gameplay to the widest, drawn from images */
+static const double scales[] = {1, 0.5, 0.25, 0.125, MIN_SCALE};
+static const char *phase_names[BenchPhases] = {
+	"sim", "scene", "osd", "present"
+};
+
+int bench_init(struct bench *b, size_t frames)
+{
+	memset(b, 0, sizeof(*b));
+	b->frames = frames;
+	b->nscales = sizeof(scales) / sizeof(*scales);
+	for (int p = 0; p < BenchPhases; ++p)
+		if (!(b->times[p] = malloc(b->nscales * frames *
+						sizeof(double)))) {
+			bench_free(b);
+			SDL_SetError("Out of memory");
+			return -1;
+		}
+	return 0;
+}
+
+int bench_done(const struct bench *b)
+{
+	return b->n >= b->nscales * b->frames;
+}
+/* The zoom of the next frame */
+double bench_scale(const struct bench *b)
+{
+	return scales[b->n / b->frames];
+}
+/* Where the camera looks in the next frame: a figure of eight over the
+ * middle four fifths of the level, flown once per zoom */
+void bench_camera(const struct bench *b, const struct cgl *l, double *x,
+		double *y)
+{
+	double a = 2 * M_PI * (b->n % b->frames) / b->frames,
+	       w = l->width * BLOCK_SIZE,
+	       h = l->height * BLOCK_SIZE;
+	*x = w / 2 + 0.4 * w * sin(a);
+	*y = h / 2 + 0.4 * h * sin(2 * a);
+}
+/* Times of the phases of a frame, in seconds */
+void bench_add(struct bench *b, const double t[BenchPhases])
+{
+	if (bench_done(b))
+		return;
+	for (int p = 0; p < BenchPhases; ++p)
+		b->times[p][b->n] = t[p];
+	++b->n;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double*)a,
+	       y = *(const double*)b;
+	return x < y ? -1 : x > y;
+}
+/* min, median, p99 and max of n times, in milliseconds */
+static void bench_stats(FILE *fp, const char *name, const double *t, size_t n,
+		double *sorted)
+{
+	memcpy(sorted, t, n * sizeof(*t));
+	qsort(sorted, n, sizeof(*sorted), cmp_double);
+	size_t p99 = (n * 99 + 99) / 100;
+	fprintf(fp, "\"%s\": {\"min\": %.3f, \"median\": %.3f, "
+			"\"p99\": %.3f, \"max\": %.3f}", name,
+			sorted[0] * 1e3,
+			(sorted[(n - 1) / 2] + sorted[n / 2]) / 2 * 1e3,
+			sorted[p99 - 1] * 1e3, sorted[n - 1] * 1e3);
+}
+static void json_string(FILE *fp, const char *s)
+{
+	fputc('"', fp);
+	for (; *s; ++s)
+		if (*s == '"' || *s == '\\')
+			fprintf(fp, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			fprintf(fp, "\\u%04x", *s);
+		else
+			fputc(*s, fp);
+	fputc('"', fp);
+}
+/* Writes what was measured to file, or to stdout if file is "-" */
+int bench_report(const struct bench *b, const char *file, const char *level,
+		const char *renderer)
+{
+	size_t nruns = b->n / b->frames;
+	if (!nruns) {
+		SDL_SetError("No run finished");
+		return -1;
+	}
+	FILE *fp = strcmp(file, "-") ? fopen(file, "w") : stdout;
+	if (!fp) {
+		SDL_SetError("Cannot open %s", file);
+		return -1;
+	}
+	double *sorted = malloc(b->frames * sizeof(*sorted));
+	if (!sorted) {
+		if (fp != stdout)
+			fclose(fp);
+		SDL_SetError("Out of memory");
+		return -1;
+	}
+	fprintf(fp, "{\n  \"level\": ");
+	json_string(fp, level);
+	fprintf(fp, ",\n  \"renderer\": ");
+	json_string(fp, renderer);
+	fprintf(fp, ",\n  \"window\": [%d, %d],\n  \"frames\": %lu,\n"
+			"  \"runs\": [\n", (int)gl.win_w, (int)gl.win_h,
+			(unsigned long)b->frames);
+	for (size_t r = 0; r < nruns; ++r) {
+		const size_t first = r * b->frames;
+		double total = 0;
+		for (size_t k = first; k < first + b->frames; ++k)
+			for (int p = 0; p < BenchPhases; ++p)
+				total += b->times[p][k];
+		fprintf(fp, "    {\"scale\": %g, \"fps\": %.1f", scales[r],
+				b->frames / total);
+		for (int p = 0; p < BenchPhases; ++p) {
+			fprintf(fp, ",\n     ");
+			bench_stats(fp, phase_names[p], b->times[p] + first,
+					b->frames, sorted);
+		}
+		fprintf(fp, "}%s\n", r + 1 < nruns ? "," : "");
+	}
+	fprintf(fp, "  ]\n}\n");
+	free(sorted);
+	int err = ferror(fp);
+	if (fp == stdout)
+		err |= fflush(fp) != 0;
+	else
+		err |= fclose(fp) != 0;
+	if (err) {
+		SDL_SetError("Cannot write %s", file);
+		return -1;
+	}
+	return 0;
+}
+
+void bench_free(struct bench *b)
+{
+	for (int p = 0; p < BenchPhases; ++p)
+		free(b->times[p]);
+	memset(b, 0, sizeof(*b));
+}
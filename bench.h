@@ -0,0 +1,64 @@
+/* bench.h - frame timing over a scripted flight
+ * Copyright (C) 2010 Michal Trybus.
+ *
+ * This file is part of FreeCG.
+ *
+ * FreeCG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeCG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeCG. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "cgl.h"
+#include <stddef.h>
+
+/*
+ * The benchmark flies the camera along a fixed path -- a figure of eight
+ * over the level -- once at each of a few zooms, a fixed number of frames
+ * each, with one step of the simulation per frame and no frame pacing.
+ * The time of each part of every frame is kept and summed up, per zoom, as
+ * the minimum, median, 99th percentile and maximum, written as JSON.
+ */
+enum bench_config {
+	/* frames at each zoom */
+	BENCH_FRAMES = 600
+};
+enum bench_phase {
+	/* the steps of the simulation, with streaming */
+	BenchSim,
+	/* the scene, traversed and submitted (which does not wait for the
+	 * GPU); the OSD, traversed; and the present, with capture: the
+	 * phases of prof.h */
+	BenchScene,
+	BenchOSD,
+	BenchPresent,
+	BenchPhases
+};
+struct bench {
+	size_t frames, nscales;
+	/* seconds, frame after frame, of each phase */
+	double *times[BenchPhases];
+	/* frames done */
+	size_t n;
+};
+
+int bench_init(struct bench*, size_t);
+int bench_done(const struct bench*);
+double bench_scale(const struct bench*);
+void bench_camera(const struct bench*, const struct cgl*, double*, double*);
+void bench_add(struct bench*, const double[BenchPhases]);
+int bench_report(const struct bench*, const char*, const char*, const char*);
+void bench_free(struct bench*);
+
+#endif
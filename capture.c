@@ -0,0 +1,262 @@
+/* capture.c - recording of frames without stalling the renderer
+ * Copyright (C) 2010 Michal Trybus.
+ *
+ * This file is part of FreeCG.
+ *
+ * FreeCG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeCG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeCG. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "capture.h"
+#include "mathgeom.h"
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+
+/* row j of the picture, counted from the top */
+static const Uint8 *frame_row(const struct capture *c,
+		const struct capture_frame *f, int j)
+{
+	return f->pixels + 4 * c->w * (f->bottom_up ? c->h - 1 - j : j);
+}
+
+/* Full range BT.601, chroma averaged over 2x2 pixels */
+static void rgba_to_yuv(const struct capture *c, const struct capture_frame *f,
+		Uint8 *yuv)
+{
+	int cw = (c->w + 1) / 2,
+	    ch = (c->h + 1) / 2;
+	Uint8 *y = yuv,
+	      *u = y + c->w * c->h,
+	      *v = u + cw * ch;
+	for (int j = 0; j < c->h; ++j) {
+		const Uint8 *p = frame_row(c, f, j);
+		for (int i = 0; i < c->w; ++i, p += 4)
+			*y++ = (77 * p[0] + 150 * p[1] + 29 * p[2] + 128) >> 8;
+	}
+	for (int j = 0; j < ch; ++j) {
+		const Uint8 *r0 = frame_row(c, f, 2 * j),
+		            *r1 = frame_row(c, f, min(2 * j + 1, c->h - 1));
+		for (int i = 0; i < cw; ++i) {
+			int i0 = 8 * i,
+			    i1 = 4 * min(2 * i + 1, c->w - 1);
+			int r = r0[i0] + r0[i1] + r1[i0] + r1[i1],
+			    g = r0[i0 + 1] + r0[i1 + 1] + r1[i0 + 1] + r1[i1 + 1],
+			    b = r0[i0 + 2] + r0[i1 + 2] + r1[i0 + 2] + r1[i1 + 2];
+			/* the sums of four are divided by 1024, around 128 */
+			*u++ = (-43 * r - 85 * g + 128 * b + 131584) >> 10;
+			*v++ = (128 * r - 107 * g - 21 * b + 131584) >> 10;
+		}
+	}
+}
+
+static int write_frame(struct capture *c, const struct capture_frame *f)
+{
+	size_t row = 4 * c->w;
+	if (c->format == CaptureY4M) {
+		size_t size = c->w * c->h + 2 * ((c->w + 1) / 2) * ((c->h + 1) / 2);
+		if (!c->nwritten)
+			c->start = f->time;
+		/* the frames of the video shown by now */
+		unsigned long due = round((f->time - c->start) * c->fps) + 1;
+		if (due <= c->nwritten)
+			return 0;
+		rgba_to_yuv(c, f, c->yuv);
+		for (; c->nwritten < due; ++c->nwritten) {
+			fputs("FRAME\n", c->fp);
+			if (fwrite(c->yuv, 1, size, c->fp) < size)
+				return -1;
+		}
+		return 0;
+	} else {
+		fprintf(c->index, "%lu %.6f %ld\n", c->nwritten, f->time,
+				ftell(c->fp));
+		for (int j = 0; j < c->h; ++j)
+			if (fwrite(frame_row(c, f, j), 1, row, c->fp) < row)
+				return -1;
+	}
+	++c->nwritten;
+	return 0;
+}
+
+static int capture_thread(void *data)
+{
+	struct capture *c = data;
+	SDL_LockMutex(c->lock);
+	for (;;) {
+		if (c->qlen == 0) {
+			if (c->quit)
+				break;
+			SDL_CondWait(c->cond, c->lock);
+			continue;
+		}
+		struct capture_frame *f = &c->queue[c->qhead];
+		int error = c->error;
+		SDL_UnlockMutex(c->lock);
+		if (!error && write_frame(c, f) < 0)
+			error = 1;
+		SDL_LockMutex(c->lock);
+		c->error = error;
+		c->qhead = (c->qhead + 1) % CAPTURE_QUEUE;
+		--c->qlen;
+	}
+	SDL_UnlockMutex(c->lock);
+	return 0;
+}
+
+struct capture *capture_open(const char *path, int w, int h, int fps)
+{
+	size_t len = strlen(path);
+	struct capture *c = calloc(1, sizeof(*c));
+	c->w = w, c->h = h;
+	c->fps = fps;
+	c->format = len > 4 && strcmp(path + len - 4, ".y4m") == 0 ?
+		CaptureY4M : CaptureRaw;
+	c->fp = fopen(path, "wb");
+	if (!c->fp) {
+		SDL_SetError("%s: %s", path, strerror(errno));
+		free(c);
+		return NULL;
+	}
+	if (c->format == CaptureY4M) {
+		fprintf(c->fp, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg "
+				"XYSCSS=420JPEG\n", w, h, fps);
+		c->yuv = malloc(w * h + 2 * ((w + 1) / 2) * ((h + 1) / 2));
+	} else {
+		char name[len + 5];
+		sprintf(name, "%s.idx", path);
+		c->index = fopen(name, "w");
+		if (!c->index) {
+			SDL_SetError("%s: %s", name, strerror(errno));
+			fclose(c->fp);
+			free(c);
+			return NULL;
+		}
+		fprintf(c->index, "# RGBA %dx%d: frame time offset\n", w, h);
+	}
+	for (size_t k = 0; k < CAPTURE_QUEUE; ++k)
+		c->queue[k].pixels = malloc(w * h * 4);
+	c->lock = SDL_CreateMutex();
+	c->cond = SDL_CreateCond();
+	c->thread = SDL_CreateThread(capture_thread, "capture", c);
+	if (!c->thread)
+		fprintf(stderr, "capture: %s, writing synchronously\n",
+				SDL_GetError());
+	return c;
+}
+
+/* Copies a frame for the writer, or drops it if the queue is full */
+static void queue_frame(struct capture *c, const Uint8 *pixels, double time,
+		int bottom_up)
+{
+	++c->nframes;
+	if (!c->thread) {
+		struct capture_frame f = {(Uint8*)pixels, time, bottom_up};
+		if (!c->error && write_frame(c, &f) < 0)
+			c->error = 1;
+		return;
+	}
+	SDL_LockMutex(c->lock);
+	size_t len = c->qlen,
+	       tail = (c->qhead + c->qlen) % CAPTURE_QUEUE;
+	SDL_UnlockMutex(c->lock);
+	if (len == CAPTURE_QUEUE) {
+		++c->ndropped;
+		return;
+	}
+	/* the writer does not touch the tail until it is queued */
+	struct capture_frame *f = &c->queue[tail];
+	memcpy(f->pixels, pixels, c->w * c->h * 4);
+	f->time = time;
+	f->bottom_up = bottom_up;
+	SDL_LockMutex(c->lock);
+	++c->qlen;
+	SDL_CondSignal(c->cond);
+	SDL_UnlockMutex(c->lock);
+}
+
+/* Maps buffer k, read CAPTURE_PBOS frames ago, and queues its frame */
+static void capture_retire(struct capture *c, size_t k)
+{
+	/* normally complete by now, so this does not block */
+	glClientWaitSync(c->fence[k], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+	glDeleteSync(c->fence[k]);
+	c->fence[k] = 0;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, c->pbo[k]);
+	const Uint8 *p = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+			c->w * c->h * 4, GL_MAP_READ_BIT);
+	if (p) {
+		queue_frame(c, p, c->pbo_time[k], 1);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+/* Starts reading back the frame just drawn, before the buffers are
+ * swapped */
+void capture_frame(struct capture *c, double time)
+{
+	size_t k = c->next;
+	if (!c->pbo[0]) {
+		glGenBuffers(CAPTURE_PBOS, c->pbo);
+		for (size_t i = 0; i < CAPTURE_PBOS; ++i) {
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, c->pbo[i]);
+			glBufferData(GL_PIXEL_PACK_BUFFER, c->w * c->h * 4,
+					NULL, GL_STREAM_READ);
+		}
+	}
+	if (c->fence[k])
+		capture_retire(c, k);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, c->pbo[k]);
+	glReadPixels(0, 0, c->w, c->h, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	c->fence[k] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	c->pbo_time[k] = time;
+	c->next = (k + 1) % CAPTURE_PBOS;
+}
+
+/* A frame already in memory, top row first, as from soft.c */
+void capture_pixels(struct capture *c, const Uint8 *pixels, double time)
+{
+	queue_frame(c, pixels, time, 0);
+}
+
+/* Writes the frames still in flight and closes the files */
+void capture_close(struct capture *c)
+{
+	for (size_t i = 0; i < CAPTURE_PBOS; ++i) {
+		size_t k = (c->next + i) % CAPTURE_PBOS;
+		if (c->fence[k])
+			capture_retire(c, k);
+	}
+	if (c->thread) {
+		SDL_LockMutex(c->lock);
+		c->quit = 1;
+		SDL_CondBroadcast(c->cond);
+		SDL_UnlockMutex(c->lock);
+		SDL_WaitThread(c->thread, NULL);
+	}
+	SDL_DestroyMutex(c->lock);
+	SDL_DestroyCond(c->cond);
+	if (c->pbo[0])
+		glDeleteBuffers(CAPTURE_PBOS, c->pbo);
+	printf("capture: %lu frames, %lu written, %lu dropped%s\n",
+			c->nframes, c->nwritten, c->ndropped,
+			c->error ? ", write error" : "");
+	fclose(c->fp);
+	if (c->index)
+		fclose(c->index);
+	for (size_t k = 0; k < CAPTURE_QUEUE; ++k)
+		free(c->queue[k].pixels);
+	free(c->yuv);
+	free(c);
+}
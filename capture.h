@@ -0,0 +1,85 @@
+/* capture.h - recording of frames without stalling the renderer
+ * Copyright (C) 2010 Michal Trybus.
+ *
+ * This file is part of FreeCG.
+ *
+ * FreeCG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeCG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeCG. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdio.h>
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_thread.h>
+#include <SDL2/SDL_opengl.h>
+
+/*
+ * Frames are read back into a ring of pixel buffer objects and mapped only
+ * when the ring comes around, by which time the transfer has finished, so
+ * the renderer never waits for the GPU. Mapped frames are copied to a queue
+ * from which a writer thread converts and writes them; when the writer
+ * falls behind, frames are dropped rather than stalling the game.
+ *
+ * A file ending in .y4m receives YUV 4:2:0 video at a fixed rate, each
+ * frame repeated or dropped to fill the frames of the video up to its
+ * time; any other file receives raw RGBA frames, top row first, with an
+ * index in file.idx giving the time and offset of each frame. Only frames
+ * of the size the capture was opened at are to be captured.
+ */
+enum capture_config {
+	/* frames in flight between glReadPixels and mapping */
+	CAPTURE_PBOS = 3,
+	/* frames waiting for the writer */
+	CAPTURE_QUEUE = 8
+};
+enum capture_format {
+	CaptureRaw,
+	CaptureY4M
+};
+struct capture_frame {
+	Uint8 *pixels;
+	double time;
+	/* rows as read by glReadPixels */
+	int bottom_up;
+};
+struct capture {
+	int w, h;
+	enum capture_format format;
+	/* frames per second of the video, and the time of its first */
+	int fps;
+	double start;
+	FILE *fp, *index;
+	GLuint pbo[CAPTURE_PBOS];
+	GLsync fence[CAPTURE_PBOS];
+	double pbo_time[CAPTURE_PBOS];
+	/* the buffer read into next */
+	size_t next;
+	struct capture_frame queue[CAPTURE_QUEUE];
+	size_t qhead, qlen;
+	/* the writer's conversion buffer */
+	Uint8 *yuv;
+	unsigned long nframes, ndropped, nwritten;
+	int quit, error;
+	SDL_Thread *thread;
+	SDL_mutex *lock;
+	SDL_cond *cond;
+};
+
+struct capture *capture_open(const char*, int, int, int);
+void capture_frame(struct capture*, double);
+void capture_pixels(struct capture*, const Uint8*, double);
+void capture_close(struct capture*);
+
+#endif
@@ -24,6 +24,7 @@
 #include <float.h>
 #include <assert.h>
 #include "sound.h"
+#include "prof.h"
 #include <SDL2/SDL.h>
 
 collision_map cmap;
@@ -169,7 +170,7 @@ void cg_handle_collisions(struct cgl *l)
 			l->height * BLOCK_SIZE);
 	for (size_t j = y; (signed)j*BLOCK_SIZE < end_y; ++j)
 		for (size_t i = x; (signed)i*BLOCK_SIZE < end_x; ++i)
-			cg_handle_collisions_block(l, l->blocks[j][i]);
+			cg_handle_collisions_block(l, cgl_block(l, i, j));
 }
 void cg_handle_collisions_block(struct cgl *l, block blk)
 {
@@ -178,6 +179,7 @@ void cg_handle_collisions_block(struct cgl *l, block blk)
 	struct tile stile;
 	ship_to_tile(l->ship, &stile);
 	for (size_t i = 0; blk[i] != NULL; ++i) {
+		++l->candidates;
 		if (!tiles_intersect(&stile, blk[i], &r))
 			continue;
 		int img_x = stile.tex_x + (r.x - stile.x),
@@ -292,8 +294,14 @@ void cg_objects_step(struct cgl *l, double time, double dt)
 void cg_step(struct cgl *l, double time)
 {
 	double dt = time - l->time;
+	Uint64 step = prof_begin(), t;
+	l->candidates = 0;
+	t = prof_begin();
 	cg_objects_animate(l, time);
+	prof_end(ProfAnimate, t);
+	t = prof_begin();
 	cg_objects_step(l, time, dt);
+	prof_end(ProfObjects, t);
 	if (l->hb->num_cargo == l->num_all_freight) {
 		l->status = Victory;
 		goto end;
@@ -301,8 +309,12 @@ void cg_step(struct cgl *l, double time)
 	if (l->status == Lost)
 		goto end;
 	if (!l->ship->dead) {
+		t = prof_begin();
 		cg_ship_step(l->ship, dt);
+		prof_end(ProfShip, t);
+		t = prof_begin();
 		cg_handle_collisions(l);
+		prof_end(ProfCollisions, t);
 	} else {
 		if (l->kaboom_end > time) {
 			cg_kaboom_step(l);
@@ -316,6 +328,7 @@ void cg_step(struct cgl *l, double time)
 	}
 end:
 	l->time = time;
+	prof_end(ProfStep, step);
 }
 
 /* ==================== Collision handlers ==================== */
@@ -390,9 +403,24 @@ int cg_handle_collision_magnet(struct ship *ship, struct magnet *magnet)
 /* ==================== /Collision handlers ==================== */
 
 /* ==================== Object simulators ==================== */
+/* Changes of tiles' appearance have to be marked for the vertex buffers */
+static inline void set_tile_type(struct tile *t, enum type type)
+{
+	if (t->type != type)
+		t->type = type, t->dirty = 1;
+}
+static inline void set_tile_tex_x(struct tile *t, int tex_x)
+{
+	if (t->tex_x != tex_x)
+		t->tex_x = tex_x, t->dirty = 1;
+}
 /* auxilliary function used by all sliding tiles */
 void update_sliding_tile(enum dir dir, struct tile *t, int len)
 {
+	int cur = dir == Right || dir == Left ? t->w : t->h;
+	if (len == cur)
+		return;
+	t->dirty = 1;
 	switch (dir) {
 	case Right:
 		t->tex_x -= len - t->w;
@@ -500,14 +528,14 @@ void cg_step_lgate(struct lgate *lgate, struct ship *ship, double dt)
 {
 	for (size_t i = 0; i < 4; ++i) {
 		if (!lgate->active) {
-			lgate->light[i]->type = Transparent;
+			set_tile_type(lgate->light[i], Transparent);
 		} else {
 			if (lgate->keys[i] && !ship->keys[i])
-				lgate->light[i]->type = Blink;
+				set_tile_type(lgate->light[i], Blink);
 			else if (lgate->keys[i])
-				lgate->light[i]->type = Simple;
+				set_tile_type(lgate->light[i], Simple);
 			else
-				lgate->light[i]->type = Transparent;
+				set_tile_type(lgate->light[i], Transparent);
 		}
 	}
 	if (!lgate->open && lgate->len < lgate->max_len)
@@ -608,13 +636,13 @@ void cg_step_airport(struct airport *airport, struct ship *ship, double time)
 void airport_pop_cargo(struct airport *airport)
 {
 	--airport->num_cargo;
-	airport->cargo[airport->num_cargo]->type = Transparent;
+	set_tile_type(airport->cargo[airport->num_cargo], Transparent);
 	airport->cargo[airport->num_cargo]->collision_test = NoCollision;
 }
 /* revert one pop */
 void airport_push_cargo(struct airport *airport)
 {
-	airport->cargo[airport->num_cargo]->type = Simple;
+	set_tile_type(airport->cargo[airport->num_cargo], Simple);
 	airport->cargo[airport->num_cargo]->collision_test = Rect;
 	++airport->num_cargo;
 }
@@ -685,27 +713,29 @@ void animate_fan(struct fan *fan, double time)
 {
 	int phase = round(time * FAN_ANIM_SPEED);
 	int cur_tex = fan_anim_order[phase % 3];
-	fan->base->tex_x = fan->tex_x + cur_tex * fan->base->w;
+	set_tile_tex_x(fan->base, fan->tex_x + cur_tex * fan->base->w);
 }
 void animate_magnet(struct magnet *magnet, double time)
 {
 	int phase = round(time * MAGNET_ANIM_SPEED);
 	int cur_tex = magnet_anim_order[phase % 4];
-	magnet->magn->tex_x = magnet->tex_x + cur_tex * magnet->magn->w;
+	set_tile_tex_x(magnet->magn,
+			magnet->tex_x + cur_tex * magnet->magn->w);
 }
 void animate_airgen(struct airgen *airgen, double time)
 {
 	int phase = round(time * AIRGEN_ANIM_SPEED);
 	int cur_tex = airgen_anim_order[phase % 8];
-	airgen->base->tex_x = airgen->tex_x + cur_tex * airgen->base->w;
+	set_tile_tex_x(airgen->base,
+			airgen->tex_x + cur_tex * airgen->base->w);
 }
 void animate_bar(struct bar *bar, double time)
 {
 	int phase = round(time * BAR_ANIM_SPEED);
 	int cur_tex = bar_anim_order[0][phase % 2];
-	bar->beg->tex_x = bar->btex_x + cur_tex * BAR_TEX_OFFSET;
+	set_tile_tex_x(bar->beg, bar->btex_x + cur_tex * BAR_TEX_OFFSET);
 	cur_tex = bar_anim_order[1][phase % 2];
-	bar->end->tex_x = bar->etex_x + cur_tex * BAR_TEX_OFFSET;
+	set_tile_tex_x(bar->end, bar->etex_x + cur_tex * BAR_TEX_OFFSET);
 }
 void animate_key(struct airport *airport, double time)
 {
@@ -713,7 +743,8 @@ void animate_key(struct airport *airport, double time)
 		return;
 	int phase = round(time * KEY_ANIM_SPEED);
 	int cur_tex = key_anim_order[phase % 8];
-	airport->cargo[0]->tex_x = KEY_TEX_X + cur_tex * airport->cargo[0]->w;
+	set_tile_tex_x(airport->cargo[0],
+			KEY_TEX_X + cur_tex * airport->cargo[0]->w);
 }
 /* ==================== /Object animators ==================== */
 
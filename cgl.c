@@ -18,8 +18,11 @@
  */
 
 #include "cgl.h"
+#include "cglpack.h"
+#include "cglstream.h"
 #include "cg.h"
 #include "mathgeom.h"
+#include "trace.h"
 #include <SDL2/SDL_error.h>
 #include <stdio.h>
 #include <math.h>
@@ -30,6 +33,8 @@ void free_cgl(struct cgl *cgl)
 {
 	if (!cgl)
 		return;
+	/* chunks must give the blocks back first */
+	cgl_stream_close(cgl);
 	free(cgl->tiles);
 	free(cgl->fans);
 	free(cgl->magnets);
@@ -39,21 +44,21 @@ void free_cgl(struct cgl *cgl)
 	free(cgl->gates);
 	free(cgl->lgates);
 	free(cgl->airports);
-	if (cgl->blocks) {
-		for (size_t j = 0; j < cgl->height; ++j) {
-			for (size_t i = 0; i < cgl->width; ++i)
-				free(cgl->blocks[j][i]);
-			free(cgl->blocks[j]);
-		}
-		free(cgl->blocks);
+	if (cgl->grid) {
+		for (size_t k = 0; k < cgl->gw * cgl->gh; ++k)
+			free(cgl->grid[k]);
+		free(cgl->grid);
 	}
+	free(cgl->block_pool);
 	free(cgl);
 }
 
 #define FIX_PTRS(what, tile, howmany, arr)\
 	for (size_t i = 0; i < howmany; ++i) \
 		what[i].tile = cgl->tiles + cgl->ntiles + (what[i].tile - arr);
-struct cgl *read_cgl(const char *path, uint8_t **out_soin)
+/* Reads a level from fp. If out_sobs is not NULL, SOBS is not read; its
+ * offset in fp is stored instead and the tiles are left to cglstream. */
+struct cgl *read_cgl_fp(FILE *fp, uint8_t **out_soin, long *out_sobs)
 {
 	extern int cgl_read_section_header(const char*, FILE*),
 		   cgl_read_header(struct cgl*, FILE*),
@@ -61,6 +66,7 @@ struct cgl *read_cgl(const char *path, uint8_t **out_soin)
 	           cgl_read_soin(struct cgl*, uint8_t*, FILE*),
 		   cgl_read_magic(struct cgl*, FILE*),
 		   cgl_read_sobs(struct cgl*, const uint8_t*, FILE*),
+		   cgl_skip_sobs(struct cgl*, long*, FILE*),
 		   /* dynamic element reading functions: */
 		   cgl_read_vent(struct cgl*, struct tile**, size_t*, FILE*),
 		   cgl_read_magn(struct cgl*, struct tile**, size_t*, FILE*),
@@ -71,13 +77,8 @@ struct cgl *read_cgl(const char *path, uint8_t **out_soin)
 		   cgl_read_barr(struct cgl*, struct tile**, size_t*, FILE*),
 		   cgl_read_lpts(struct cgl*, struct tile**, size_t*, FILE*);
 	struct cgl *cgl;
-	FILE *fp;
 	uint8_t *soin = NULL;
-	fp = fopen(path, "rb");
-	if (!fp) {
-		SDL_SetError("fopen: %s", strerror(errno));
-		return NULL;
-	}
+	Uint64 t = trace_begin();
 	cgl = calloc(1, sizeof(*cgl));
 	cgl->tiles    = NULL;
 	cgl->fans     = NULL;
@@ -88,7 +89,8 @@ struct cgl *read_cgl(const char *path, uint8_t **out_soin)
 	cgl->gates    = NULL;
 	cgl->lgates   = NULL;
 	cgl->airports = NULL;
-	cgl->blocks   = NULL;
+	cgl->grid     = NULL;
+	cgl->block_pool = NULL;
 	if (cgl_read_section_header("CGL1", fp) != 0)
 		goto error;
 	if (cgl_read_size(cgl, fp) != 0)
@@ -98,8 +100,12 @@ struct cgl *read_cgl(const char *path, uint8_t **out_soin)
 		goto error;
 	if (cgl_read_magic(cgl, fp) != 0)
 		goto error;
-	if (cgl_read_sobs(cgl, soin, fp) != 0)
+	if (out_sobs) {
+		if (cgl_skip_sobs(cgl, out_sobs, fp) != 0)
+			goto error;
+	} else if (cgl_read_sobs(cgl, soin, fp) != 0) {
 		goto error;
+	}
 	struct tile *vent_tiles, *magn_tiles, *dist_tiles, *cano_tiles,
 		    *pipe_tiles, *onew_tiles, *barr_tiles, *lpts_tiles;
 	size_t nvent_tiles, nmagn_tiles, ndist_tiles, ncano_tiles,
@@ -221,16 +227,74 @@ struct cgl *read_cgl(const char *path, uint8_t **out_soin)
 		*out_soin = soin;
 	else
 		free(soin);
-	fclose(fp);
+	trace_end("read_cgl", t);
 	return cgl;
 error:
-	fclose(fp);
 	if (soin)
 		free(soin);
 	free_cgl(cgl);
+	trace_end("read_cgl", t);
 	return NULL;
 }
 
+/* Reads a level from an already opened pack. The member is parsed straight
+ * from the mapping of the pack file. */
+struct cgl *read_cgl_pack(const struct cgl_pack *pack, const char *name,
+		uint8_t **out_soin)
+{
+	const struct cgl_pack_entry *e = cgl_pack_find(pack, name);
+	if (!e)
+		return NULL;
+	FILE *fp = cgl_pack_fopen(pack, e);
+	if (!fp)
+		return NULL;
+	struct cgl *cgl = read_cgl_fp(fp, out_soin, NULL);
+	fclose(fp);
+	return cgl;
+}
+
+/* Opens a level given either as a path to a CGL file or as a pack member
+ * "pack.cgp:NAME". In the latter case the pack is returned through out_pack
+ * and must be closed after the stream. */
+FILE *cgl_fopen(const char *path, struct cgl_pack **out_pack)
+{
+	FILE *fp;
+	const char *sep = strrchr(path, ':');
+	*out_pack = NULL;
+	if (sep && sep[1] != '\\' && sep[1] != '/') {
+		char *pack_path = calloc(sep - path + 1, 1);
+		memcpy(pack_path, path, sep - path);
+		struct cgl_pack *pack = cgl_pack_open(pack_path);
+		free(pack_path);
+		if (pack) {
+			const struct cgl_pack_entry *e =
+				cgl_pack_find(pack, sep + 1);
+			fp = e ? cgl_pack_fopen(pack, e) : NULL;
+			if (fp)
+				*out_pack = pack;
+			else
+				cgl_pack_close(pack);
+			return fp;
+		}
+	}
+	fp = fopen(path, "rb");
+	if (!fp)
+		SDL_SetError("fopen: %s", strerror(errno));
+	return fp;
+}
+
+struct cgl *read_cgl(const char *path, uint8_t **out_soin)
+{
+	struct cgl_pack *pack;
+	FILE *fp = cgl_fopen(path, &pack);
+	if (!fp)
+		return NULL;
+	struct cgl *cgl = read_cgl_fp(fp, out_soin, NULL);
+	fclose(fp);
+	cgl_pack_close(pack);
+	return cgl;
+}
+
 int read_short(int16_t arr[], size_t num, FILE *fp)
 {
 	/* FIXME: Add big-endian support */
@@ -300,6 +364,7 @@ int cgl_read_soin(struct cgl *cgl, uint8_t *nums, FILE *fp)
 {
 	size_t nread,
 	       nblocks = cgl->height * cgl->width;
+	Uint64 t = trace_begin();
 	int err = cgl_read_section_header("SOIN", fp);
 	if (err)
 		return err;
@@ -312,6 +377,7 @@ int cgl_read_soin(struct cgl *cgl, uint8_t *nums, FILE *fp)
 	for (size_t j = 0; j < cgl->height; ++j)
 		for (size_t i = 0; i < cgl->width; ++i)
 			cgl->ntiles += (*nums++ &= 0x7f);
+	trace_end("cgl_read_soin", t);
 	return 0;
 }
 
@@ -335,28 +401,99 @@ int cgl_read_magic(struct cgl *cgl, FILE *fp)
 	return 0;
 }
 
+/* Z-order key of an object with index idx */
+struct zkey {
+	uint32_t key;
+	size_t idx;
+	size_t first;
+};
+static int cmp_zkey(const void *a, const void *b)
+{
+	const struct zkey *za = a, *zb = b;
+	return za->key < zb->key ? -1 : za->key > zb->key;
+}
+static int cmp_zkey_idx(const void *a, const void *b)
+{
+	const struct zkey *za = a, *zb = b;
+	return za->idx < zb->idx ? -1 : za->idx > zb->idx;
+}
+
+/* SOBS stores tiles row by row; they are put in Z-order of their blocks
+ * instead, so that tiles near each other in both axes are near in memory.
+ * The position in the file is kept in order: of overlapping tiles, the
+ * first in the file stays on top. */
 int cgl_read_sobs(struct cgl *cgl, const uint8_t *soin, FILE *fp)
 {
 	extern int read_block(struct tile*, size_t, int, int, FILE*);
 	int err;
+	Uint64 t = trace_begin();
 	err = cgl_read_section_header("SOBS", fp);
 	if (err)
 		return err;
 	cgl->tiles = calloc(cgl->ntiles, sizeof(*cgl->tiles));
-	struct tile *tile_ptr = cgl->tiles;
-	size_t cur_block = 0;
-	for (size_t j = 0; j < cgl->height; ++j) {
-		for (size_t i = 0; i < cgl->width; ++i, ++cur_block) {
-			err = read_block(tile_ptr, (size_t)soin[cur_block],
-					i * CGL_BLOCK_SIZE, j * CGL_BLOCK_SIZE, fp);
-			if (err)
-				return err;
-			tile_ptr += soin[cur_block];
+	cgl->nstatic = cgl->ntiles;
+	size_t nblocks = cgl->width * cgl->height,
+	       n = 0;
+	for (size_t k = 0; k < nblocks; ++k)
+		n += soin[k] != 0;
+	struct zkey *order = malloc(n * sizeof(*order));
+	n = 0;
+	for (size_t k = 0; k < nblocks; ++k)
+		if (soin[k]) {
+			order[n].key = morton(k % cgl->width, k / cgl->width);
+			order[n++].idx = k;
 		}
+	qsort(order, n, sizeof(*order), cmp_zkey);
+	for (size_t k = 0, first = 0; k < n; ++k) {
+		order[k].first = first;
+		first += soin[order[k].idx];
+	}
+	qsort(order, n, sizeof(*order), cmp_zkey_idx);
+	for (size_t k = 0, seq = 0; k < n; ++k) {
+		size_t b = order[k].idx;
+		struct tile *tiles = cgl->tiles + order[k].first;
+		err = read_block(tiles, soin[b],
+				b % cgl->width * CGL_BLOCK_SIZE,
+				b / cgl->width * CGL_BLOCK_SIZE, fp);
+		if (err)
+			break;
+		for (size_t i = 0; i < soin[b]; ++i)
+			tiles[i].order = seq++;
+	}
+	free(order);
+	trace_end("cgl_read_sobs", t);
+	return err;
+}
+
+/* Used instead of cgl_read_sobs when static tiles are streamed: only the
+ * position of the section is remembered */
+int cgl_skip_sobs(struct cgl *cgl, long *offset, FILE *fp)
+{
+	int err = cgl_read_section_header("SOBS", fp);
+	if (err)
+		return err;
+	*offset = ftell(fp);
+	if (fseek(fp, cgl->ntiles * SOBS_TILE_SIZE, SEEK_CUR) != 0) {
+		SDL_SetError("cgl SOBS section corrupted (incomplete)");
+		return -EBADSOBS;
 	}
+	cgl->ntiles = 0;
+	cgl->nstatic = 0;
 	return 0;
 }
 
+/* Fills a tile with the 4-byte SOBS description; (x, y) is the origin of the
+ * block the tile is anchored in */
+void cgl_decode_sobs_tile(const uint8_t *buf, int x, int y, struct tile *t)
+{
+	t->x = x + UNIT * (buf[0] >> 4);
+	t->y = y + UNIT * (buf[0] & 0x0f);
+	t->w = UNIT * (buf[1] >> 4);
+	t->h = UNIT * (buf[1] & 0x0f);
+	t->tex_y = UNIT * buf[2];
+	t->tex_x = UNIT * buf[3];
+}
+
 int read_block(struct tile *tiles, size_t num, int x, int y, FILE* fp)
 {
 	uint8_t buf[4];
@@ -368,12 +505,7 @@ int read_block(struct tile *tiles, size_t num, int x, int y, FILE* fp)
 					"(incomplete)");
 			return -EBADSOBS;
 		}
-		tiles[k].x = x + UNIT * (buf[0] >> 4);
-		tiles[k].y = y + UNIT * (buf[0] & 0x0f);
-		tiles[k].w = UNIT * (buf[1] >> 4);
-		tiles[k].h = UNIT * (buf[1] & 0x0f);
-		tiles[k].tex_y = UNIT * buf[2];
-		tiles[k].tex_x = UNIT * buf[3];
+		cgl_decode_sobs_tile(buf, x, y, &tiles[k]);
 	}
 	return 0;
 }
@@ -436,6 +568,7 @@ int cgl_read_##what(struct cgl *cgl, struct tile **out_tiles,               \
 	extern int cgl_read_one_##what(struct obj*, FILE*);                 \
 	uint32_t num;                                                       \
 	int err;                                                            \
+	Uint64 t = trace_begin();                                           \
 	err = cgl_read_section_header(#hdr, fp);                            \
 	if (err)                                                            \
 		return err;                                                 \
@@ -447,7 +580,7 @@ int cgl_read_##what(struct cgl *cgl, struct tile **out_tiles,               \
 	cgl->obj##s = calloc(num, sizeof(*cgl->obj##s));                    \
 	struct tile *tiles = calloc(howmany * num, sizeof(*tiles));         \
 	for (size_t i = 0; i < howmany * num; ++i)                          \
-		tiles[i].z = DYN_TILES_Z;                                   \
+		tiles[i].layer = LayerDynamic;                              \
 	*out_tiles = tiles;                                                 \
 	for (size_t i = 0; i < num; ++i) {
 
@@ -456,6 +589,7 @@ int cgl_read_##what(struct cgl *cgl, struct tile **out_tiles,               \
 		if (err)                                                    \
 			goto error;                                         \
 	}                                                                   \
+	trace_end("cgl_read_" #what, t);                                    \
 	return 0;                                                           \
 error:                                                                      \
 	SDL_SetError("cgl " #hdr " section corrupted (incomplete)");        \
@@ -777,7 +911,7 @@ int cgl_read_one_onew(struct gate *gate, FILE *fp)
 	arrow_dir = (arrow_dir + 4) % 4;
 	gate->arrow->tex_y = ARROW_TEX_Y;
 	gate->arrow->tex_x = ARROW_SIDE * arrow_dir;
-	gate->arrow->z = DYN_TILES_OVERLAY_Z;
+	gate->arrow->layer = LayerOverlay;
 	return 0;
 }
 
@@ -785,7 +919,7 @@ void set_light_tile(struct tile *light, int num, int x, int y)
 {
 	set_dims(light, x, y, 8, 8, LIGHTS_TEX_X + num*8, LIGHTS_TEX_Y);
 	set_type(light, Transparent, NoCollision, 0, NULL);
-	light->z = DYN_TILES_OVERLAY_Z;
+	light->layer = LayerOverlay;
 }
 
 BEGIN_CGL_READ_X(barr, BARR, lgate, 11)
@@ -910,13 +1044,13 @@ int cgl_read_one_lpts(struct airport *airport, FILE *fp)
 		airport->base->y + STRIPE_OFFS,
 		airport->base->w - 2*STRIPE_OFFS - STRIPE_END_W, STRIPE_H,
 		TILESET_W, stripe_tex_y - STRIPE_ORYG_Y);
-	airport->stripe[0]->z = DYN_TILES_OVERLAY_Z;
+	airport->stripe[0]->layer = LayerOverlay;
 	set_dims(airport->stripe[1],
 		airport->stripe[0]->x + airport->stripe[0]->w,
 		airport->stripe[0]->y,
 		STRIPE_END_W, STRIPE_H,
 		STRIPE_ORYG_X + STRIPE_ORYG_W - STRIPE_END_W, stripe_tex_y);
-	airport->stripe[1]->z = DYN_TILES_OVERLAY_Z;
+	airport->stripe[1]->layer = LayerOverlay;
 	if (airport->has_left_arrow) {
 		parse_tile_normal(larrow_data, airport->arrow[0]);
 		airport->arrow[0]->x = airport->base->x;
@@ -974,6 +1108,47 @@ int cgl_read_one_lpts(struct airport *airport, FILE *fp)
 
 /* ------------------------------------------------------------------------*/
 
+struct tile *cgl_empty_block[1] = {NULL};
+
+/* Returns a modifiable reference to the block list (i, j), allocating its
+ * super-cell if necessary */
+block *cgl_block_ref(struct cgl *cgl, size_t i, size_t j)
+{
+	struct cgl_super **s = &cgl->grid[(j >> GRID_SHIFT) * cgl->gw +
+		(i >> GRID_SHIFT)];
+	if (!*s) {
+		*s = malloc(sizeof(**s));
+		for (size_t c = 0; c < GRID_SUPER * GRID_SUPER; ++c)
+			(*s)->cells[c] = cgl_empty_block;
+	}
+	return &(*s)->cells[cgl_cell(i, j)];
+}
+
+/* Frees super-cell (si, sj) if all its blocks became empty */
+void cgl_trim_super(struct cgl *cgl, size_t si, size_t sj)
+{
+	struct cgl_super **s = &cgl->grid[sj * cgl->gw + si];
+	if (!*s)
+		return;
+	for (size_t c = 0; c < GRID_SUPER * GRID_SUPER; ++c)
+		if ((*s)->cells[c] != cgl_empty_block)
+			return;
+	free(*s);
+	*s = NULL;
+}
+
+/* The tiles in the order of the file: the static ones by their order,
+ * the dynamic ones after them as stored. Freed by the caller. */
+struct tile **cgl_file_order(const struct cgl *cgl)
+{
+	struct tile **tiles = malloc(cgl->ntiles * sizeof(*tiles));
+	for (size_t k = 0; k < cgl->nstatic; ++k)
+		tiles[cgl->tiles[k].order] = &cgl->tiles[k];
+	for (size_t k = cgl->nstatic; k < cgl->ntiles; ++k)
+		tiles[k] = &cgl->tiles[k];
+	return tiles;
+}
+
 void cgl_preprocess(struct cgl *cgl)
 {
 	/* below are the expected dimensions of the gamefield. Unfortunately,
@@ -981,6 +1156,7 @@ void cgl_preprocess(struct cgl *cgl)
 	 * correction is necessary afterwards */
 	unsigned width_px = cgl->width * CGL_BLOCK_SIZE,
 		 height_px = cgl->height * CGL_BLOCK_SIZE;
+	Uint64 t = trace_begin();
 	for (size_t k = 0; k < cgl->ntiles; ++k) {
 		width_px = max(width_px, cgl->tiles[k].x + cgl->tiles[k].w);
 		height_px = max(height_px, cgl->tiles[k].y + cgl->tiles[k].h);
@@ -989,8 +1165,16 @@ void cgl_preprocess(struct cgl *cgl)
 	 * instead of CGL_BLOCK_SIZE */
 	cgl->width = (size_t)ceil((double)width_px / BLOCK_SIZE);
 	cgl->height = (size_t)ceil((double)height_px / BLOCK_SIZE);
-	size_t *sizes = calloc(cgl->width * cgl->height, sizeof(*sizes)),
-	       *is = calloc(cgl->width * cgl->height, sizeof(*is));
+	cgl->gw = (cgl->width + GRID_SUPER - 1) >> GRID_SHIFT;
+	cgl->gh = (cgl->height + GRID_SUPER - 1) >> GRID_SHIFT;
+	cgl->grid = calloc(cgl->gw * cgl->gh, sizeof(*cgl->grid));
+	/* count the tiles of each block; only the super-cells containing any
+	 * tiles are allocated */
+	size_t *ord = calloc(cgl->gw * cgl->gh, sizeof(*ord)),
+	       nsupers = 0,
+	       cap = 0,
+	       total = 0;
+	uint32_t *sizes = NULL;
 	for (size_t k = 0; k < cgl->ntiles; ++k) {
 		size_t x = cgl->tiles[k].x / BLOCK_SIZE,
 		       y = cgl->tiles[k].y / BLOCK_SIZE;
@@ -999,30 +1183,66 @@ void cgl_preprocess(struct cgl *cgl)
 		for (size_t j = y; j*BLOCK_SIZE < (size_t)cgl->tiles[k].y +
 				cgl->tiles[k].h; ++j)
 			for (size_t i = x; i*BLOCK_SIZE < (size_t)cgl->tiles[k].x +
-					cgl->tiles[k].w; ++i)
-				sizes[i + j * cgl->width]++;
-	}
-	cgl->blocks = calloc(cgl->height, sizeof(*cgl->blocks));
-	for (size_t j = 0; j < cgl->height; ++j) {
-		cgl->blocks[j] = calloc(cgl->width, sizeof(**cgl->blocks));
-		for (size_t i = 0; i < cgl->width; ++i)
-			cgl->blocks[j][i] = calloc(sizes[i + j*cgl->width] + 1,
-					sizeof(**cgl->blocks));
+					cgl->tiles[k].w; ++i) {
+				size_t g = (j >> GRID_SHIFT) * cgl->gw +
+					(i >> GRID_SHIFT);
+				if (!cgl->grid[g]) {
+					(void)cgl_block_ref(cgl, i, j);
+					ord[g] = nsupers++;
+				}
+				if (nsupers > cap) {
+					size_t n = GRID_SUPER * GRID_SUPER;
+					sizes = realloc(sizes, 2 * nsupers * n *
+							sizeof(*sizes));
+					memset(sizes + cap * n, 0, (2 * nsupers -
+						cap) * n * sizeof(*sizes));
+					cap = 2 * nsupers;
+				}
+				++sizes[ord[g] * GRID_SUPER * GRID_SUPER +
+					cgl_cell(i, j)];
+			}
 	}
-	for (size_t k = 0; k < cgl->ntiles; ++k) {
-		size_t x = cgl->tiles[k].x / BLOCK_SIZE,
-		       y = cgl->tiles[k].y / BLOCK_SIZE;
-		for (size_t j = y; j*BLOCK_SIZE < (size_t)cgl->tiles[k].y +
-				cgl->tiles[k].h; ++j)
-			for (size_t i = x; i*BLOCK_SIZE < (size_t)cgl->tiles[k].x +
-					cgl->tiles[k].w; ++i)
-				cgl->blocks[j][i][is[i + j*cgl->width]++] = &cgl->tiles[k];
+	for (size_t k = 0; k < nsupers * GRID_SUPER * GRID_SUPER; ++k)
+		total += sizes[k] ? sizes[k] + 1 : 0;
+	cgl->block_pool = calloc(total, sizeof(*cgl->block_pool));
+	/* lay the lists out in Z-order of super-cells too */
+	struct zkey *zorder = malloc(nsupers * sizeof(*zorder));
+	size_t nz = 0;
+	for (size_t g = 0; g < cgl->gw * cgl->gh; ++g)
+		if (cgl->grid[g]) {
+			zorder[nz].key = morton(g % cgl->gw, g / cgl->gw);
+			zorder[nz++].idx = g;
+		}
+	qsort(zorder, nz, sizeof(*zorder), cmp_zkey);
+	struct tile **p = cgl->block_pool;
+	for (size_t z = 0; z < nz; ++z) {
+		size_t g = zorder[z].idx;
+		const uint32_t *n = sizes + ord[g] * GRID_SUPER * GRID_SUPER;
+		for (size_t c = 0; c < GRID_SUPER * GRID_SUPER; ++c) {
+			if (!n[c])
+				continue;
+			/* the list is filled from its end, see below */
+			cgl->grid[g]->cells[c] = p + n[c];
+			p += n[c] + 1;
+		}
 	}
-	for (size_t j = 0; j < cgl->height; ++j)
-		for (size_t i = 0; i < cgl->width; ++i)
-			cgl->blocks[j][i][is[i + j*cgl->width]] = NULL;
+	free(zorder);
 	free(sizes);
-	free(is);
+	free(ord);
+	/* lists in the order of the file, the draw priority */
+	struct tile **tiles = cgl_file_order(cgl);
+	for (size_t k = cgl->ntiles; k-- > 0; ) {
+		size_t x = tiles[k]->x / BLOCK_SIZE,
+		       y = tiles[k]->y / BLOCK_SIZE;
+		for (size_t j = y; j*BLOCK_SIZE < (size_t)tiles[k]->y +
+				tiles[k]->h; ++j)
+			for (size_t i = x; i*BLOCK_SIZE < (size_t)tiles[k]->x +
+					tiles[k]->w; ++i) {
+				block *b = cgl_block_ref(cgl, i, j);
+				*--*b = tiles[k];
+			}
+	}
+	free(tiles);
 	cgl->num_all_freight = 0;
 	cgl->num_1ups = 0;
 	/* Find the homebase and count number of freightt */
@@ -1043,4 +1263,5 @@ void cgl_preprocess(struct cgl *cgl)
 			break;
 		}
 	}
+	trace_end("cgl_preprocess", t);
 }
@@ -52,10 +52,17 @@ enum cgl_sizes {
 	LPTS_NUM_SHORTS = 6,
 	LPTS_NUM_STUFF = 10
 };
-/* All dynamic tiles (not in SOBS) are placed above the rest */
-#define DYN_TILES_Z 0.1
-/* Some dynamic tiles consist of 2 layers. Second layer's Z */
-#define DYN_TILES_OVERLAY_Z 0.2
+/* Layers of the scene, drawn in this order; within a layer, the first of
+ * overlapping tiles stays on top */
+enum layer {
+	LayerStatic = 0,
+	/* all dynamic tiles (not in SOBS) are placed above the rest */
+	LayerDynamic,
+	/* some dynamic tiles consist of 2 layers: the second one */
+	LayerOverlay,
+	LayerShip,
+	LayerOSD
+};
 enum error_codes {
 	EBADHDR = 1,
 	EBADSHDR,
@@ -77,14 +84,12 @@ enum error_codes {
 };
 /* The main tile data structure. Used to represent all objects in the game. */
 struct tile {
-	/* origin */
-	short x, y;
+	/* origin - int, as generated maps may be wider than 32767 px */
+	int x, y;
 	/* dimensions */
 	unsigned short w, h;
 	/* texture position - assume the same dimensions of texture */
 	short tex_x, tex_y;
-	/* z-value - from 0 (lowest) to 1 (highest) */
-	double z;
 	enum type {
 		/* drawn normally */
 		Simple = 0,
@@ -123,6 +128,18 @@ struct tile {
 	/* necessary for renderer, the number of the most recent frame in
 	 * which the tile was rendered */
 	unsigned int lframe;
+	/* the tile is drawn from a vertex buffer (see glvbo.h); dirty is set
+	 * whenever its appearance changes and it has to be uploaded again */
+	unsigned char buffered,
+		      dirty;
+	/* enum layer, in a byte */
+	unsigned char layer;
+	/* the renderer animates the texture itself, so a change of tex_x
+	 * alone does not make it dirty (see gl33.h) */
+	unsigned char anim_on_gpu;
+	/* position among the static tiles of the file, which are stored in
+	 * another order (see cgl_read_sobs) */
+	unsigned int order;
 	/* additional data necessary for collision detection */
 	void *data;
 };
@@ -266,6 +283,19 @@ struct airport {
 	} c /* common */;
 };
 typedef struct tile **block;
+/* Blocks are indexed by a sparse two-level grid: GRID_SUPER x GRID_SUPER
+ * blocks form a super-cell, which is not allocated if all its blocks are
+ * empty. Empty blocks share cgl_empty_block. */
+enum cgl_grid {
+	GRID_SHIFT = 4,
+	GRID_SUPER = 1 << GRID_SHIFT,
+	GRID_MASK = GRID_SUPER - 1
+};
+struct cgl_super {
+	/* in Z-order, see cgl_cell() */
+	block cells[GRID_SUPER * GRID_SUPER];
+};
+extern struct tile *cgl_empty_block[1];
 /* cgl level contents */
 enum game_status {
 	Alive = 0,
@@ -282,6 +312,8 @@ struct cgl {
 	size_t width, height;
 	size_t ntiles;
 	struct tile *tiles;
+	/* tiles[0..nstatic) come from SOBS and never change */
+	size_t nstatic;
 	size_t nfans;
 	struct fan *fans;
 	size_t nmagnets;
@@ -299,16 +331,51 @@ struct cgl {
 	size_t nairports;
 	struct airport *airports;
 	struct airport *hb;
-	block **blocks;
+	/* super-cells, gw x gh of them, row by row; only pointers, so the
+	 * order matters little */
+	struct cgl_super **grid;
+	size_t gw, gh;
+	/* storage of the block lists built by cgl_preprocess, in Z-order of
+	 * blocks */
+	struct tile **block_pool;
+	/* non-NULL if static tiles are loaded on demand, see cglstream.h */
+	struct cgl_stream *stream;
 
 	double time;
 	struct ship *ship;
 	double kaboom_end;
 	enum game_status status;
+	/* tiles tested against the ship in the last step */
+	size_t candidates;
 };
 
+/* NULL if all blocks of super-cell (si, sj) are empty */
+static inline const struct cgl_super *cgl_super(const struct cgl *l,
+		size_t si, size_t sj)
+{
+	return l->grid[sj * l->gw + si];
+}
+/* index of block (i, j) in its super-cell; Z-order keeps neighbours in both
+ * axes close in memory */
+static inline size_t cgl_cell(size_t i, size_t j)
+{
+	return morton(i & GRID_MASK, j & GRID_MASK);
+}
+/* all tiles which may be found in block (i, j), NULL-terminated */
+static inline block cgl_block(const struct cgl *l, size_t i, size_t j)
+{
+	const struct cgl_super *s = cgl_super(l, i >> GRID_SHIFT,
+			j >> GRID_SHIFT);
+	return s ? s->cells[cgl_cell(i, j)] : cgl_empty_block;
+}
+
+struct cgl_pack;
 struct cgl *read_cgl(const char*, uint8_t**);
+struct cgl *read_cgl_pack(const struct cgl_pack*, const char*, uint8_t**);
 void cgl_preprocess(struct cgl*);
+struct tile **cgl_file_order(const struct cgl*);
+block *cgl_block_ref(struct cgl*, size_t, size_t);
+void cgl_trim_super(struct cgl*, size_t, size_t);
 void free_cgl(struct cgl*);
 
 #endif
@@ -0,0 +1,456 @@
+/* cgl_gen.c - synthetic CGL level generator used to benchmark huge maps
+ * Copyright (C) 2010 Michal Trybus.
+ *
+ * This file is part of FreeCG.
+ *
+ * FreeCG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeCG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeCG. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cgl.h"
+#include "cg.h"
+#include <SDL2/SDL_error.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+/*
+ * The generated levels are meant for benchmarking, not for playing: objects
+ * are laid out on a coarse grid of free areas and static tiles are scattered
+ * randomly around them. Texture coordinates only have to point somewhere
+ * inside GRAVITY.GFX.
+ */
+enum gen_consts {
+	/* objects use 16-bit coordinates in the CGL format, so they can only
+	 * be placed in the top-left 32767x32767 px of the map */
+	GEN_MAX_OBJ_BLOCKS = 32767 / CGL_BLOCK_SIZE - 8,
+	GEN_PLACE_TRIES = 64,
+	GEN_NUM_WALLS = 6
+};
+/* origins of textures used for static tiles, in units */
+static const uint8_t wall_tex[GEN_NUM_WALLS][2] = {
+	{0, 0}, {8, 0}, {16, 0}, {0, 8}, {8, 8}, {16, 8}
+};
+
+struct gen_config {
+	size_t width, height;
+	double density;
+	int max_tiles;
+	size_t nfans, nmagnets, nairgens, ncannons, nbars, ngates, nlgates,
+	       nairports;
+	unsigned seed;
+	int demo;
+};
+struct gen_state {
+	const struct gen_config *cfg;
+	/* CGL blocks taken by objects, static tiles are not placed there */
+	uint8_t *occ;
+	size_t obj_w, obj_h;
+	FILE *fp;
+	int err;
+};
+
+/* ==================== Output ==================== */
+void put_bytes(struct gen_state *g, const void *buf, size_t n)
+{
+	if (fwrite(buf, 1, n, g->fp) < n)
+		g->err = 1;
+}
+void put_short(struct gen_state *g, int v)
+{
+	uint8_t b[2] = {v & 0xff, (v >> 8) & 0xff};
+	put_bytes(g, b, 2);
+}
+void put_integer(struct gen_state *g, uint32_t v)
+{
+	uint8_t b[4] = {v, v >> 8, v >> 16, v >> 24};
+	put_bytes(g, b, 4);
+}
+void put_shorts(struct gen_state *g, const int *v, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+		put_short(g, v[i]);
+}
+/* The reader looks for the demo marker before each section from SOBS on,
+ * and the last one it finds decides the type */
+void put_header(struct gen_state *g, const char *hdr)
+{
+	if (g->cfg->demo)
+		put_bytes(g, CGL_MAGIC, CGL_MAGIC_SIZE);
+	put_bytes(g, hdr, CGL_SHDR_SIZE);
+}
+void put_section(struct gen_state *g, const char *hdr, uint32_t num)
+{
+	put_header(g, hdr);
+	put_integer(g, num);
+}
+
+/* ==================== Placement ==================== */
+/* Finds a free area of w x h CGL blocks (plus a 1 block margin), marks it as
+ * occupied and returns its origin in px. */
+int place(struct gen_state *g, int w, int h, int *x, int *y)
+{
+	size_t W = g->cfg->width;
+	if ((size_t)w + 2 > g->obj_w || (size_t)h + 2 > g->obj_h)
+		return -1;
+	for (int t = 0; t < GEN_PLACE_TRIES; ++t) {
+		int bx = rand_range(1, g->obj_w - w - 1),
+		    by = rand_range(1, g->obj_h - h - 1);
+		int free = 1;
+		for (int j = by - 1; free && j <= by + h; ++j)
+			for (int i = bx - 1; free && i <= bx + w; ++i)
+				free = !g->occ[i + j*W];
+		if (!free)
+			continue;
+		for (int j = by - 1; j <= by + h; ++j)
+			for (int i = bx - 1; i <= bx + w; ++i)
+				g->occ[i + j*W] = 1;
+		*x = bx * CGL_BLOCK_SIZE;
+		*y = by * CGL_BLOCK_SIZE;
+		return 0;
+	}
+	return -1;
+}
+/* places objects of one kind; returns the number actually placed */
+size_t place_all(struct gen_state *g, size_t n, int w, int h, int (*xy)[2])
+{
+	size_t k = 0;
+	for (size_t i = 0; i < n; ++i)
+		if (place(g, w, h, &xy[k][0], &xy[k][1]) == 0)
+			++k;
+	if (k < n)
+		fprintf(stderr, "warning: placed only %zu of %zu objects "
+				"(%dx%d blocks)\n", k, n, w, h);
+	return k;
+}
+
+/* ==================== Sections ==================== */
+void gen_static(struct gen_state *g)
+{
+	const struct gen_config *cfg = g->cfg;
+	size_t nblocks = cfg->width * cfg->height;
+	uint8_t *soin = calloc(nblocks, 1);
+	for (size_t k = 0; k < nblocks; ++k)
+		if (!g->occ[k] && rand() < cfg->density * RAND_MAX)
+			soin[k] = rand_range(1, cfg->max_tiles);
+	put_bytes(g, "SOIN", CGL_SHDR_SIZE);
+	put_bytes(g, soin, nblocks);
+	put_header(g, "SOBS");
+	for (size_t k = 0; k < nblocks; ++k) {
+		for (int t = 0; t < soin[k]; ++t) {
+			/* tiles of 2..8 units anchored inside of the block */
+			int w = rand_range(2, 8),
+			    h = rand_range(2, 8),
+			    x = rand_range(0, 8 - w),
+			    y = rand_range(0, 8 - h);
+			const uint8_t *tex = wall_tex[rand() % GEN_NUM_WALLS];
+			uint8_t tile[SOBS_TILE_SIZE] = {
+				x << 4 | y, w << 4 | h, tex[1], tex[0]
+			};
+			put_bytes(g, tile, SOBS_TILE_SIZE);
+		}
+	}
+	free(soin);
+}
+/* fans, magnets and air generators share the layout: base, second tile
+ * and the area of interaction. All of them act upwards. */
+void gen_field_objects(struct gen_state *g, const char *hdr, int (*xy)[2],
+		size_t n, int type, int base_size, int base_tex_x, int base_tex_y)
+{
+	put_section(g, hdr, n);
+	for (size_t i = 0; i < n; ++i) {
+		int x = xy[i][0],
+		    y = xy[i][1] + 4*CGL_BLOCK_SIZE;
+		uint8_t h[VENT_HDR_SIZE] = {type << 4 | Up, 0};
+		int s[VENT_NUM_SHORTS] = {
+			x, y, base_tex_x, base_tex_y,
+			/* second tile, directly above the base */
+			x, y - 16, base_size, 16, base_tex_x, base_tex_y + 48,
+			/* bounding box */
+			x, y - 16, base_size, base_size + 16,
+			/* area of interaction */
+			x, y - 4*CGL_BLOCK_SIZE, base_size, 4*CGL_BLOCK_SIZE - 16
+		};
+		put_bytes(g, h, VENT_HDR_SIZE);
+		put_shorts(g, s, VENT_NUM_SHORTS);
+	}
+}
+void gen_cannons(struct gen_state *g, int (*xy)[2], size_t n)
+{
+	put_section(g, "CANO", n);
+	for (size_t i = 0; i < n; ++i) {
+		int x = xy[i][0],
+		    y = xy[i][1],
+		    len = 6*CGL_BLOCK_SIZE;
+		uint8_t h[CANO_HDR_SIZE] = {Right, 0, 0};
+		uint8_t speed[2] = {40, 0};
+		int s[CANO_NUM_SHORTS] = {
+			/* bullet track */
+			x + 24, y + 4, x + len, y + 4,
+			/* base, cannon, end base */
+			x, y, x + 24, y, 512, 172,
+			x + len, y + 4,
+			/* catcher */
+			x + len - 16, y + 4, 16, 16, 472, 212,
+			/* bounding box */
+			x, y, len + 16, 24
+		};
+		put_bytes(g, h, CANO_HDR_SIZE);
+		put_short(g, 3);
+		put_bytes(g, speed, 2);
+		put_shorts(g, s, CANO_NUM_SHORTS);
+	}
+}
+void gen_bars(struct gen_state *g, int (*xy)[2], size_t n)
+{
+	put_section(g, "PIPE", n);
+	for (size_t i = 0; i < n; ++i) {
+		uint8_t h[PIPE_HDR_SIZE] = {0};
+		h[0] = Horizontal | (rand() % 2) << 4;
+		h[2] = 16;
+		h[6] = 1;
+		h[7] = 6;
+		h[10] = 1;
+		int s[PIPE_NUM_SHORTS] = {
+			xy[i][0], xy[i][1], 8*CGL_BLOCK_SIZE, BAR_BASE_H
+		};
+		put_bytes(g, h, PIPE_HDR_SIZE);
+		put_shorts(g, s, PIPE_NUM_SHORTS);
+	}
+}
+/* one-way gates and gates with locks share the layout: a vertical bar
+ * hanging from the top base */
+void gen_gates(struct gen_state *g, const char *hdr, int (*xy)[2], size_t n,
+		int lock)
+{
+	put_section(g, hdr, n);
+	for (size_t i = 0; i < n; ++i) {
+		int x = xy[i][0],
+		    y = xy[i][1],
+		    len = 4*CGL_BLOCK_SIZE;
+		uint8_t h = lock ? GateTop | (rand() % 16) << 4 :
+			GateTop | Vertical << 4;
+		int s[ONEW_NUM_SHORTS] = {
+			len, len,
+			/* x, y, tex_x and tex_y of 5 bases */
+			x, x, x, x, x,
+			y, y + 32, y + 32, y + 32 + len, y + 32 + len,
+			440, 440, 440, 440, 440,
+			228, 228, 228, 228, 228,
+			/* bar */
+			x, y + 32, 0, 0, 0, 0,
+			/* area of interaction */
+			x - 2*CGL_BLOCK_SIZE, y + 32, 5*CGL_BLOCK_SIZE, len
+		};
+		put_bytes(g, &h, ONEW_HDR_SIZE);
+		put_shorts(g, s, ONEW_NUM_SHORTS);
+	}
+}
+void gen_airports(struct gen_state *g, int (*xy)[2], size_t n)
+{
+	put_section(g, "LPTS", n);
+	for (size_t i = 0; i < n; ++i) {
+		/* the first one is the homebase, the rest carry freight */
+		int type = i == 0 ? 1 : 4,
+		    ncargo = i == 0 ? 0 : rand_range(1, 3),
+		    width = 3;
+		int x = xy[i][0],
+		    y = xy[i][1];
+		uint8_t h = type;
+		int s[LPTS_NUM_SHORTS] = {
+			x, y, width, 392, 316, STRIPE_ORYG_Y
+		};
+		uint8_t nc = ncargo,
+			stuff[LPTS_NUM_STUFF*3] = {0};
+		for (int k = 0; k < ncargo; ++k) {
+			stuff[k] = 8 + k*(STUFF_SIZE + 4);
+			stuff[10+k] = 32 - STUFF_SIZE;
+			stuff[20+k] = rand_range(1, 4);
+		}
+		int lbbox[4] = {x, y, width*CGL_BLOCK_SIZE, 32};
+		put_bytes(g, &h, LPTS_HDR_SIZE);
+		put_shorts(g, s, LPTS_NUM_SHORTS);
+		put_bytes(g, &nc, 1);
+		put_bytes(g, stuff, sizeof(stuff));
+		put_shorts(g, lbbox, 4);
+	}
+}
+
+int generate(const struct gen_config *cfg, const char *path)
+{
+	struct gen_state g = {
+		.cfg = cfg,
+		.occ = calloc(cfg->width * cfg->height, 1),
+		.obj_w = min(cfg->width, GEN_MAX_OBJ_BLOCKS),
+		.obj_h = min(cfg->height, GEN_MAX_OBJ_BLOCKS)
+	};
+	size_t nobjs = cfg->nfans + cfg->nmagnets + cfg->nairgens +
+		cfg->ncannons + cfg->nbars + cfg->ngates + cfg->nlgates +
+		cfg->nairports;
+	int (*xy)[2] = calloc(nobjs + 1, sizeof(*xy)),
+	    (*p)[2] = xy;
+	/* airports go first, so that there's always room for the homebase */
+	size_t nairports = place_all(&g, cfg->nairports, 4, 2, p);
+	if (nairports == 0) {
+		SDL_SetError("no room for the homebase");
+		free(xy);
+		free(g.occ);
+		return -1;
+	}
+	int (*airports)[2] = p;       p += nairports;
+	int (*fans)[2] = p;           p += place_all(&g, cfg->nfans, 2, 6, p);
+	int (*magnets)[2] = p;        p += place_all(&g, cfg->nmagnets, 2, 6, p);
+	int (*airgens)[2] = p;        p += place_all(&g, cfg->nairgens, 2, 6, p);
+	int (*cannons)[2] = p;        p += place_all(&g, cfg->ncannons, 8, 2, p);
+	int (*bars)[2] = p;           p += place_all(&g, cfg->nbars, 9, 1, p);
+	int (*gates)[2] = p;          p += place_all(&g, cfg->ngates, 2, 7, p);
+	int (*lgates)[2] = p;         p += place_all(&g, cfg->nlgates, 2, 7, p);
+	g.fp = fopen(path, "wb");
+	if (!g.fp) {
+		SDL_SetError("fopen: %s", strerror(errno));
+		free(xy);
+		free(g.occ);
+		return -1;
+	}
+	put_bytes(&g, "CGL1", CGL_SHDR_SIZE);
+	put_bytes(&g, "SIZE", CGL_SHDR_SIZE);
+	put_integer(&g, cfg->width);
+	put_integer(&g, cfg->height);
+	gen_static(&g);
+	gen_field_objects(&g, "VENT", fans, magnets - fans, Hi, 48, 0, 140);
+	gen_field_objects(&g, "MAGN", magnets, airgens - magnets, 0, 32,
+			144, 140);
+	gen_field_objects(&g, "DIST", airgens, cannons - airgens, CW, 40,
+			240, 140);
+	gen_cannons(&g, cannons, bars - cannons);
+	gen_bars(&g, bars, gates - bars);
+	gen_gates(&g, "ONEW", gates, lgates - gates, 0);
+	gen_gates(&g, "BARR", lgates, p - lgates, 1);
+	gen_airports(&g, airports, nairports);
+	if (fclose(g.fp) != 0 || g.err)
+		SDL_SetError("fwrite: %s", strerror(errno));
+	free(xy);
+	free(g.occ);
+	return g.err ? -1 : 0;
+}
+
+/* Reads the level back and runs the preprocessor on it */
+int check(const struct gen_config *cfg, const char *path)
+{
+	clock_t t0 = clock();
+	struct cgl *cgl = read_cgl(path, NULL);
+	if (!cgl)
+		return -1;
+	clock_t t1 = clock();
+	if (cgl->width != cfg->width || cgl->height != cfg->height ||
+	    cgl->nairports == 0 || cgl->type != (cfg->demo ? Demo : Full)) {
+		SDL_SetError("level read back does not match");
+		free_cgl(cgl);
+		return -1;
+	}
+	cgl_preprocess(cgl);
+	clock_t t2 = clock();
+	printf("%s: %zux%zu blocks, %zu tiles, %zu fans, %zu magnets, "
+	       "%zu airgens, %zu cannons, %zu bars, %zu gates, %zu lgates, "
+	       "%zu airports\n", path, cfg->width, cfg->height, cgl->ntiles,
+	       cgl->nfans, cgl->nmagnets, cgl->nairgens, cgl->ncannons,
+	       cgl->nbars, cgl->ngates, cgl->nlgates, cgl->nairports);
+	printf("read_cgl: %.1f ms, cgl_preprocess: %.1f ms\n",
+			(t1 - t0) * 1000.0 / CLOCKS_PER_SEC,
+			(t2 - t1) * 1000.0 / CLOCKS_PER_SEC);
+	free_cgl(cgl);
+	return 0;
+}
+
+void usage(const char *prog)
+{
+	printf("Usage: %s [options] out.cgl\n"
+	       "  -size WxH      map size in 32x32 blocks (default 64x64)\n"
+	       "  -density D     fraction of blocks with tiles (default 0.3)\n"
+	       "  -tiles N       max. tiles per block, 1..127 (default 3)\n"
+	       "  -fans N, -magnets N, -airgens N, -cannons N, -bars N,\n"
+	       "  -gates N, -lgates N\n"
+	       "                 number of objects (default 0)\n"
+	       "  -airports N    number of airports including the homebase "
+	       "(default 2)\n"
+	       "  -seed S        random seed (default 1)\n"
+	       "  -demo          mark the level as a demo level\n"
+	       "  -nocheck       do not read the level back\n", prog);
+	exit(-1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct gen_config cfg = {
+		.width = 64, .height = 64,
+		.density = 0.3,
+		.max_tiles = 3,
+		.nairports = 2,
+		.seed = 1
+	};
+	struct {
+		const char *name;
+		size_t *val;
+	} counts[] = {
+		{"-fans", &cfg.nfans},       {"-magnets", &cfg.nmagnets},
+		{"-airgens", &cfg.nairgens}, {"-cannons", &cfg.ncannons},
+		{"-bars", &cfg.nbars},       {"-gates", &cfg.ngates},
+		{"-lgates", &cfg.nlgates},   {"-airports", &cfg.nairports}
+	};
+	const char *out = NULL;
+	int do_check = 1;
+	for (int i = 1; i < argc; ++i) {
+		const char *a = argv[i];
+		int has_arg = i + 1 < argc;
+		size_t k;
+		for (k = 0; k < ARRSZ(counts); ++k)
+			if (strcmp(a, counts[k].name) == 0)
+				break;
+		if (k < ARRSZ(counts) && has_arg) {
+			*counts[k].val = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(a, "-size") == 0 && has_arg) {
+			if (sscanf(argv[++i], "%zux%zu", &cfg.width,
+						&cfg.height) != 2)
+				usage(argv[0]);
+		} else if (strcmp(a, "-density") == 0 && has_arg) {
+			cfg.density = atof(argv[++i]);
+		} else if (strcmp(a, "-tiles") == 0 && has_arg) {
+			cfg.max_tiles = atoi(argv[++i]);
+		} else if (strcmp(a, "-seed") == 0 && has_arg) {
+			cfg.seed = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(a, "-demo") == 0) {
+			cfg.demo = 1;
+		} else if (strcmp(a, "-nocheck") == 0) {
+			do_check = 0;
+		} else if (a[0] != '-' && !out) {
+			out = a;
+		} else {
+			usage(argv[0]);
+		}
+	}
+	if (!out || cfg.width < 8 || cfg.height < 8 ||
+	    cfg.max_tiles < 1 || cfg.max_tiles > 0x7f)
+		usage(argv[0]);
+	srand(cfg.seed);
+	if (generate(&cfg, out) != 0) {
+		fprintf(stderr, "generate: %s\n", SDL_GetError());
+		return 1;
+	}
+	if (do_check && check(&cfg, out) != 0) {
+		fprintf(stderr, "check: %s\n", SDL_GetError());
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,140 @@
+/* cgl_pack.c - packs CGL level files into a single CGP archive
+ * Copyright (C) 2010 Michal Trybus.
+ *
+ * This file is part of FreeCG.
+ *
+ * FreeCG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeCG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeCG. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cgl.h"
+#include "cglpack.h"
+#include <SDL2/SDL_error.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+uint8_t *slurp(const char *path, size_t *size)
+{
+	FILE *fp = fopen(path, "rb");
+	if (!fp) {
+		SDL_SetError("fopen: %s", strerror(errno));
+		return NULL;
+	}
+	(void)fseek(fp, 0, SEEK_END);
+	*size = ftell(fp);
+	(void)fseek(fp, 0, SEEK_SET);
+	uint8_t *buf = malloc(*size);
+	if (fread(buf, 1, *size, fp) < *size) {
+		SDL_SetError("fread: %s", strerror(errno));
+		free(buf);
+		buf = NULL;
+	}
+	fclose(fp);
+	return buf;
+}
+
+/* fill in the index entry of a single level */
+int describe_level(const char *path, struct cgl_pack_entry *e)
+{
+	struct cgl *cgl = read_cgl(path, NULL);
+	if (!cgl)
+		return -1;
+	const char *base = strrchr(path, '/');
+	base = base ? base + 1 : path;
+	if (strlen(base) > CGP_NAME_SIZE) {
+		SDL_SetError("level name %s too long", base);
+		free_cgl(cgl);
+		return -1;
+	}
+	strcpy(e->name, base);
+	e->demo = cgl->type == Demo;
+	e->counts[CgpWidth]    = cgl->width;
+	e->counts[CgpHeight]   = cgl->height;
+	e->counts[CgpTiles]    = cgl->ntiles;
+	e->counts[CgpFans]     = cgl->nfans;
+	e->counts[CgpMagnets]  = cgl->nmagnets;
+	e->counts[CgpAirgens]  = cgl->nairgens;
+	e->counts[CgpCannons]  = cgl->ncannons;
+	e->counts[CgpBars]     = cgl->nbars;
+	e->counts[CgpGates]    = cgl->ngates;
+	e->counts[CgpLGates]   = cgl->nlgates;
+	e->counts[CgpAirports] = cgl->nairports;
+	free_cgl(cgl);
+	return 0;
+}
+
+int list_pack(const char *path)
+{
+	struct cgl_pack *pack = cgl_pack_open(path);
+	if (!pack) {
+		fprintf(stderr, "cgl_pack_open: %s\n", SDL_GetError());
+		return 1;
+	}
+	printf("%-24s %8s %8s %4s %9s %6s %5s %5s\n", "name", "offset", "size",
+			"demo", "blocks", "tiles", "objs", "ports");
+	for (size_t i = 0; i < pack->nentries; ++i) {
+		const struct cgl_pack_entry *e = &pack->entries[i];
+		const uint32_t *c = e->counts;
+		unsigned objs = c[CgpFans] + c[CgpMagnets] + c[CgpAirgens] +
+			c[CgpCannons] + c[CgpBars] + c[CgpGates] + c[CgpLGates];
+		printf("%-24s %8u %8u %4s %4ux%-4u %6u %5u %5u\n", e->name,
+				e->offset, e->size, e->demo ? "yes" : "no",
+				c[CgpWidth], c[CgpHeight], c[CgpTiles], objs,
+				c[CgpAirports]);
+	}
+	cgl_pack_close(pack);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc == 3 && strcmp(argv[1], "-l") == 0)
+		return list_pack(argv[2]);
+	if (argc < 3) {
+		printf("Usage: %s out.cgp LEVEL.CGL [LEVEL.CGL ...]\n"
+		       "       %s -l file.cgp\n", argv[0], argv[0]);
+		exit(-1);
+	}
+	size_t n = argc - 2;
+	struct cgl_pack_entry *entries = calloc(n, sizeof(*entries));
+	uint8_t **data = calloc(n, sizeof(*data));
+	int ret = 1;
+	for (size_t i = 0; i < n; ++i) {
+		const char *path = argv[i + 2];
+		size_t size;
+		if (describe_level(path, &entries[i]) != 0 ||
+		    !(data[i] = slurp(path, &size))) {
+			fprintf(stderr, "%s: %s\n", path, SDL_GetError());
+			goto cleanup;
+		}
+		entries[i].size = size;
+	}
+	FILE *fp = fopen(argv[1], "wb");
+	if (!fp) {
+		fprintf(stderr, "fopen: %s\n", strerror(errno));
+		goto cleanup;
+	}
+	if (cgl_pack_write(fp, entries, (const uint8_t *const*)data, n) != 0)
+		fprintf(stderr, "cgl_pack_write: %s\n", SDL_GetError());
+	else
+		ret = 0;
+	fclose(fp);
+cleanup:
+	for (size_t i = 0; i < n; ++i)
+		free(data[i]);
+	free(data);
+	free(entries);
+	return ret;
+}
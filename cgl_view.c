@@ -21,8 +21,17 @@
 #include "texmgr.h"
 #include "gfx.h"
 #include "cg.h"
+#include "cglstream.h"
+#include "interp.h"
+#include "pacer.h"
+#include "sim.h"
+#include "bench.h"
+#include "prof.h"
+#include "trace.h"
 
 #include <stdio.h>
+#include <math.h>
+#include <string.h>
 #include <assert.h>
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
@@ -43,6 +52,16 @@ unsigned long __stack = 1024 * 1024;
 int mouse, running;
 SDL_GameController *gameController = NULL;
 SDL_Window *window;
+struct sim sim;
+
+/* Game input is the simulation's, applied at the step due after e; dropped
+ * if it has stopped taking it */
+static void input(const SDL_Event *e, enum sim_action action, int n, double v)
+{
+	struct sim_input in = {action, n, v,
+		sim_event_time(&sim, e->common.timestamp)};
+	sim_push(&sim, &in);
+}
 
 void process_event(SDL_Event *e)
 {
@@ -50,6 +69,12 @@ void process_event(SDL_Event *e)
     case SDL_QUIT:
         running = 0;
         break;
+    case SDL_WINDOWEVENT:
+        if (e->window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+            gl_resize_viewport(e->window.data1, e->window.data2);
+            osd_resize(e->window.data1, e->window.data2);
+        }
+        break;
     case SDL_MOUSEMOTION:
         if (mouse) {
             gl.cam.nx -= e->motion.xrel/gl.cam.scale;
@@ -62,10 +87,11 @@ void process_event(SDL_Event *e)
             mouse = 0;
             break;
         case 4:
-            gl.cam.scale += 0.2;
+            gl.cam.scale *= 1.25;
             break;
         case 5:
-            gl.cam.scale -= 0.2;
+            /* zooming out further is cheap (see gllod.h), but not to 0 */
+            gl.cam.scale = fmax(MIN_SCALE, gl.cam.scale / 1.25);
             break;
         }
         break;
@@ -83,10 +109,10 @@ void process_event(SDL_Event *e)
             if (abs(e->caxis.value) > 3200) {
                 // Convertir la valeur du stick (-32768 à 32767) en vitesse de rotation
                 float rot_speed = e->caxis.value / 6000.0;
-                gl.l->ship->rot_speed = rot_speed;
+                input(e, SimRotate, 0, rot_speed);
             } else {
                 // Dans la zone morte
-                gl.l->ship->rot_speed = 0;
+                input(e, SimRotate, 0, 0);
             }
         }
         break;
@@ -95,7 +121,7 @@ void process_event(SDL_Event *e)
         switch (e->cbutton.button) {
         case SDL_CONTROLLER_BUTTON_A:
             // Bouton A - activer le moteur
-            cg_ship_set_engine(gl.l->ship, 1);
+            input(e, SimEngine, 1, 0);
             break;
         case SDL_CONTROLLER_BUTTON_B:
             // Bouton B
@@ -103,19 +129,19 @@ void process_event(SDL_Event *e)
             break;
         case SDL_CONTROLLER_BUTTON_LEFTSHOULDER:
             // Bouton LB - clé 1
-            gl.l->ship->keys[0] = !gl.l->ship->keys[0];
+            input(e, SimKey, 0, 0);
             break;
         case SDL_CONTROLLER_BUTTON_RIGHTSHOULDER:
             // Bouton RB - clé 2
-            gl.l->ship->keys[1] = !gl.l->ship->keys[1];
+            input(e, SimKey, 1, 0);
             break;
         case SDL_CONTROLLER_BUTTON_BACK:
             // Bouton Back - clé 3 (à la place de LT)
-            gl.l->ship->keys[2] = !gl.l->ship->keys[2];
+            input(e, SimKey, 2, 0);
             break;
         case SDL_CONTROLLER_BUTTON_START:
             // Bouton Start - clé 4 (à la place de RT)
-            gl.l->ship->keys[3] = !gl.l->ship->keys[3];
+            input(e, SimKey, 3, 0);
             break;
         }
         break;
@@ -123,7 +149,7 @@ void process_event(SDL_Event *e)
         switch (e->cbutton.button) {
         case SDL_CONTROLLER_BUTTON_A:
             // Bouton A - désactiver le moteur quand relâché
-            cg_ship_set_engine(gl.l->ship, 0);
+            input(e, SimEngine, 0, 0);
             break;
         }
         break;
@@ -140,29 +166,39 @@ void process_event(SDL_Event *e)
             running = 0;
             break;
         case SDLK_KP_1:
-            gl.l->ship->keys[0] = !gl.l->ship->keys[0];
+            input(e, SimKey, 0, 0);
             break;
         case SDLK_KP_2:
-            gl.l->ship->keys[1] = !gl.l->ship->keys[1];
+            input(e, SimKey, 1, 0);
             break;
         case SDLK_KP_3:
-            gl.l->ship->keys[2] = !gl.l->ship->keys[2];
+            input(e, SimKey, 2, 0);
             break;
         case SDLK_KP_4:
-            gl.l->ship->keys[3] = !gl.l->ship->keys[3];
+            input(e, SimKey, 3, 0);
             break;
         case SDLK_LEFT:
-            gl.l->ship->rot_speed = -5.5;
+            input(e, SimRotate, 0, -5.5);
             break;
         case SDLK_RIGHT:
-            gl.l->ship->rot_speed = 5.5;
+            input(e, SimRotate, 0, 5.5);
             break;
         case SDLK_UP:
-			cg_ship_set_engine(gl.l->ship, 1);
+			input(e, SimEngine, 1, 0);
 			break;
         case SDLK_o:
             osd_toggle();
             break;
+        case SDLK_p:
+            prof_print(stdout);
+            break;
+        case SDLK_h:
+            osd_perf_toggle();
+            break;
+        case SDLK_t:
+            if (trace_flush() < 0)
+                fprintf(stderr, "trace_flush: %s\n", SDL_GetError());
+            break;
         default:
             break;
         }
@@ -170,15 +206,13 @@ void process_event(SDL_Event *e)
     case SDL_KEYUP:
         switch(e->key.keysym.sym) {
         case SDLK_UP:
-			cg_ship_set_engine(gl.l->ship, 0);
+			input(e, SimEngine, 0, 0);
             break;
         case SDLK_LEFT:
-            if (gl.l->ship->rot_speed == -5.5)
-                gl.l->ship->rot_speed = 0;
+            input(e, SimRotateEnd, 0, -5.5);
             break;
         case SDLK_RIGHT:
-            if (gl.l->ship->rot_speed == 5.5)
-                gl.l->ship->rot_speed = 0;
+            input(e, SimRotateEnd, 0, 5.5);
             break;
         default:
             break;
@@ -187,33 +221,162 @@ void process_event(SDL_Event *e)
     }
 }
 
+/* The frame times of a scripted flight, see bench.h */
+static void run_bench(struct cgl *cgl, const char *file, const char *level,
+		int follow)
+{
+	struct bench b;
+	SDL_Event e;
+	if (bench_init(&b, BENCH_FRAMES) < 0) {
+		fprintf(stderr, "bench_init: %s\n", SDL_GetError());
+		return;
+	}
+	for (unsigned int f = 0; running && !bench_done(&b); ++f) {
+		Uint64 t0 = prof_begin();
+		while (SDL_PollEvent(&e))
+			process_event(&e);
+		prof_end(ProfEvents, t0);
+		t0 = SDL_GetPerformanceCounter();
+		cgl_stream_update(cgl, &gl.viewport);
+		sim_run(&sim, 1);
+		gl.state = sim_acquire(&sim);
+		gl.interp.alpha = 1;
+		double t[BenchPhases];
+		t[BenchSim] = (double)(SDL_GetPerformanceCounter() - t0) /
+			SDL_GetPerformanceFrequency();
+		if (follow) {
+			gl.cam.nx = gl.state->ship.x + SHIP_W/2.0;
+			gl.cam.ny = gl.state->ship.y + SHIP_H/2.0;
+		} else {
+			bench_camera(&b, cgl, &gl.cam.nx, &gl.cam.ny);
+		}
+		gl.cam.x = gl.cam.nx;
+		gl.cam.y = gl.cam.ny;
+		gl.cam.scale = bench_scale(&b);
+		gl_update_window(f * SIM_STEP);
+		t[BenchScene] = prof_last(ProfScene) + prof_last(ProfSubmit);
+		t[BenchOSD] = prof_last(ProfOSDStep) + prof_last(ProfOSDDraw);
+		t[BenchPresent] = prof_last(ProfSwap);
+		bench_add(&b, t);
+	}
+	const char *renderer = gl.soft ? "soft" : gl.gl33 ? "gl33" : "gl";
+	char name[64];
+	snprintf(name, sizeof(name), "%s%s%s", renderer,
+			gl.nocache ? " no-cache" : "",
+			cgl->stream ? " stream" : "");
+	if (bench_report(&b, file, level, name) < 0)
+		fprintf(stderr, "bench_report: %s\n", SDL_GetError());
+	bench_free(&b);
+}
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s [--stream N] [--gl33] [--no-cache] [--soft]\n"
+	       "       [--capture FILE] [--fps N] [--no-vsync]\n"
+	       "       [--record FILE | --replay FILE] [--bench FILE]\n"
+	       "       [--trace FILE]\n"
+	       "       file.cgl [width height]\n"
+	       "  --stream N   load static tiles on demand in chunks of NxN blocks\n"
+	       "  --gl33       render with OpenGL 3.3 core profile shaders\n"
+	       "  --no-cache   draw static tiles one by one, not from textures\n"
+	       "  --soft       render without GL, on the CPU\n"
+	       "  --capture FILE  record the frames, as video if FILE is .y4m\n"
+	       "  --fps N      start frames N times a second (default: as vsync\n"
+	       "               or the display)\n"
+	       "  --no-vsync   do not wait for the display when presenting\n"
+	       "  --record FILE  write the input of the game to FILE\n"
+	       "  --replay FILE  play the input recorded in FILE instead\n"
+	       "  --bench FILE   fly over the level at several zooms as fast as\n"
+	       "               possible and write frame times to FILE as JSON\n"
+	       "               (- for stdout); the camera follows the ship\n"
+	       "               if replaying\n"
+	       "  --trace FILE   write spans of loading and of the frames to\n"
+	       "               FILE for a trace viewer, at exit or on T\n",
+	       prog);
+	exit(-1);
+}
+
 int main(int argc, char *argv[])
 {
-	if (!(argc == 2 || argc == 4)) {
-		printf("Usage: %s file.cgl [width height]\n", argv[0]);
-		exit(-1);
+	const char *prog = argv[0];
+	size_t stream = 0;
+	const char *capture = NULL,
+	           *record = NULL,
+	           *replay = NULL,
+	           *bench = NULL;
+	int fps = 0,
+	    vsync = 1;
+	for (; argc > 1 && strncmp(argv[1], "--", 2) == 0; --argc, ++argv) {
+		if (strcmp(argv[1], "--stream") == 0 && argc > 2 &&
+		    atoi(argv[2]) > 0) {
+			stream = atoi(argv[2]);
+			--argc, ++argv;
+		} else if (strcmp(argv[1], "--gl33") == 0) {
+			gl.gl33 = 1;
+		} else if (strcmp(argv[1], "--no-cache") == 0) {
+			gl.nocache = 1;
+		} else if (strcmp(argv[1], "--soft") == 0) {
+			gl.soft = 1;
+			tm_in_memory = 1;
+		} else if (strcmp(argv[1], "--capture") == 0 && argc > 2) {
+			capture = argv[2];
+			--argc, ++argv;
+		} else if (strcmp(argv[1], "--fps") == 0 && argc > 2 &&
+		    atoi(argv[2]) > 0) {
+			fps = atoi(argv[2]);
+			--argc, ++argv;
+		} else if (strcmp(argv[1], "--no-vsync") == 0) {
+			vsync = 0;
+		} else if (strcmp(argv[1], "--record") == 0 && argc > 2) {
+			record = argv[2];
+			--argc, ++argv;
+		} else if (strcmp(argv[1], "--replay") == 0 && argc > 2) {
+			replay = argv[2];
+			--argc, ++argv;
+		} else if (strcmp(argv[1], "--trace") == 0 && argc > 2) {
+			if (trace_start(argv[2]) < 0)
+				fprintf(stderr, "trace_start: %s\n",
+						SDL_GetError());
+			--argc, ++argv;
+		} else if (strcmp(argv[1], "--bench") == 0 && argc > 2) {
+			bench = argv[2];
+			vsync = 0;
+			--argc, ++argv;
+		} else {
+			usage(prog);
+		}
 	}
+	if (!(argc == 2 || argc == 4) || (record && replay))
+		usage(prog);
+	Uint64 ts = trace_begin();
 	SDL_Surface *gfx = load_gfx("data/GRAVITY.GFX");
+	trace_end("load_gfx", ts);
 	if (!gfx) {
 		fprintf(stderr, "read_gfx: %s\n", SDL_GetError());
 		abort();
 	}
+	ts = trace_begin();
 	SDL_Surface *png = load_png("data/font.png");
+	trace_end("load_png", ts);
 	if (!png) {
 		fprintf(stderr, "load_png: %s\n", SDL_GetError());
 		abort();
 	}
+	ts = trace_begin();
 	SDL_Surface *osd = load_png("data/osd.png");
+	trace_end("load_png", ts);
 	if (!osd) {
 		fprintf(stderr, "load_png: %s\n", SDL_GetError());
 		abort();
 	}
-	struct cgl *cgl = read_cgl(argv[1], NULL);
+	struct cgl *cgl = stream ? read_cgl_stream(argv[1], stream) :
+		read_cgl(argv[1], NULL);
 	if (!cgl) {
 		fprintf(stderr, "read_cgl: %s\n", SDL_GetError());
 		abort();
 	}
 	cgl_preprocess(cgl);
+	cgl_stream_start(cgl);
 	cg_init(cgl);
 	make_collision_map(gfx, cmap);
 	if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_GAMECONTROLLER) != 0) {
@@ -240,9 +403,18 @@ int main(int argc, char *argv[])
 	}
 	
 	sound_init();
+	ts = trace_begin();
 	sound_load();
+	trace_end("sound_load", ts);
 	
-	SDL_GLContext glContext;
+	SDL_GLContext glContext = NULL;
+	Uint32 mode = gl.soft ? 0 : MODE;
+	if (gl.gl33) {
+		SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+		SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+		SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK,
+				SDL_GL_CONTEXT_PROFILE_CORE);
+	}
 
 	if (argc == 4) {
 		int w = atoi(argv[2]),
@@ -252,21 +424,21 @@ int main(int argc, char *argv[])
 								SDL_WINDOWPOS_UNDEFINED, 
 								SDL_WINDOWPOS_UNDEFINED,
 								w, h, 
-								SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE);
+								mode | SDL_WINDOW_RESIZABLE);
 		} else {
 			fprintf(stderr, "Wrong resolution");
 			window = SDL_CreateWindow("FreeCG", 
 								SDL_WINDOWPOS_UNDEFINED, 
 								SDL_WINDOWPOS_UNDEFINED,
 								SCREEN_W, SCREEN_H, 
-								SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE);
+								mode | SDL_WINDOW_RESIZABLE);
 		}
 	} else {
 		window = SDL_CreateWindow("FreeCG", 
 							SDL_WINDOWPOS_UNDEFINED, 
 							SDL_WINDOWPOS_UNDEFINED,
 							SCREEN_W, SCREEN_H, 
-							SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE);
+							mode | SDL_WINDOW_RESIZABLE);
 	}
 
 	if (!window) {
@@ -275,10 +447,12 @@ int main(int argc, char *argv[])
 	}
 
 	// Création du contexte OpenGL
-	glContext = SDL_GL_CreateContext(window);
-	if (!glContext) {
-		fprintf(stderr, "OpenGL context creation failed: %s\n", SDL_GetError());
-		abort();
+	if (!gl.soft) {
+		glContext = SDL_GL_CreateContext(window);
+		if (!glContext) {
+			fprintf(stderr, "OpenGL context creation failed: %s\n", SDL_GetError());
+			abort();
+		}
 	}
 	
 	gl_set_window(window);
@@ -287,68 +461,94 @@ int main(int argc, char *argv[])
 	SDL_GetWindowSize(window, &w, &h);
 	gl_resize_viewport(w, h);
 	
-	struct texmgr *ttm = tm_request_texture(gfx);
-	struct texmgr *fnt = tm_request_texture(png);
-	struct texmgr *otm = tm_request_texture(osd);
-	gl_init(cgl, ttm, fnt, otm);
-	int t = SDL_GetTicks(),
-	    nt = t,
-	    time = t,
-	    fr = 0;
+	/* the OSD's own images go in after the three */
+	SDL_Surface *images[3 + OSD_IMAGES] = {gfx, png, osd};
+	struct texmgr *tms[3 + OSD_IMAGES];
+	osd_images(cgl, images + 3);
+	tm_request_atlas(images, 3 + OSD_IMAGES, tms);
+	osd_set_images(tms + 3);
+	for (int k = 3; k < 3 + OSD_IMAGES; ++k)
+		SDL_FreeSurface(images[k]);
+	if (sim_init(&sim, cgl) < 0) {
+		fprintf(stderr, "sim_init: %s\n", SDL_GetError());
+		abort();
+	}
+	if (record && sim_record(&sim, record) < 0) {
+		fprintf(stderr, "sim_record: %s\n", SDL_GetError());
+		abort();
+	}
+	if (replay && sim_replay(&sim, replay) < 0) {
+		fprintf(stderr, "sim_replay: %s\n", SDL_GetError());
+		abort();
+	}
+	/* the static tiles may be drawn by gl_init already */
+	gl.state = sim_acquire(&sim);
+	gl_init(cgl, tms[0], tms[1], tms[2]);
+	/* streamed levels change under the collisions as the view moves;
+	 * benchmarks take the steps themselves */
+	if (!bench && !cgl->stream && sim_start(&sim) < 0)
+		fprintf(stderr, "sim_start: %s, stepping in the main loop\n",
+				SDL_GetError());
+	struct pacer pacer;
+	pacer_init(&pacer, window, fps, vsync);
+	if (capture && !(gl.capture = capture_open(capture, w, h, pacer.rate)))
+		fprintf(stderr, "capture_open: %s\n", SDL_GetError());
+	double t = pacer_time(&pacer),
+	       time = t;
+	unsigned int fr = 0;
 	running = 1;
 	mouse = 0;
 	SDL_Event e;
 	
-	// Définition des constantes pour la limitation du framerate
-    const int TARGET_FPS = 60;
-    const int FRAME_DELAY = 1000 / TARGET_FPS;
-    int frameStart;
-    int frameTime;
-	
+	if (bench) {
+		run_bench(cgl, bench, argv[1], replay != NULL);
+		running = 0;
+	}
 	while (running) {
-		
-		// Enregistrement du temps de début de frame
-        frameStart = SDL_GetTicks();
-		
+		Uint64 t0 = prof_begin();
 		while (SDL_PollEvent(&e))
 			process_event(&e);
-			
-		time = SDL_GetTicks();
-		nt = time - t;
-		cg_step(cgl, time / 1000.0);
-		if (nt > 5000) {
-			printf("%d frames in %d ms - %.1f fps\n",
-					gl.frame - fr, nt, (float)(gl.frame - fr) / nt * 1000);
-			if (cgl->status == Lost)
+		prof_end(ProfEvents, t0);
+
+		time = pacer_time(&pacer);
+		cgl_stream_update(cgl, &gl.viewport);
+		sim_update(&sim);
+		gl.state = sim_acquire(&sim);
+		gl.interp.alpha = sim_alpha(&sim, gl.state);
+		if (time - t > 5) {
+			printf("%u frames in %d ms - %.1f fps\n",
+					gl.frame - fr, (int)((time - t) * 1000),
+					(gl.frame - fr) / (time - t));
+			if (gl.state->status == Lost)
 				printf("Dead. Game over!");
-			if (cgl->status == Victory)
+			if (gl.state->status == Victory)
 				printf("You won!");
 			fflush(stdout);
 
-			t += nt;
+			t = time;
 			fr = gl.frame;
 		}
-		gl.cam.nx = cgl->ship->x + SHIP_W/2.0;
-		gl.cam.ny = cgl->ship->y + SHIP_H/2.0;
-		gl_update_window(time / 1000.0);
-		SDL_GL_SwapWindow(window);
-		
-		// Calcul du temps écoulé pour cette frame
-        frameTime = SDL_GetTicks() - frameStart;
-        
-        // Si le temps écoulé est inférieur au délai cible, attendre
-        if (frameTime < FRAME_DELAY) {
-            SDL_Delay(FRAME_DELAY - frameTime);
-		}
+		double sx, sy;
+		interp_ship(&gl.interp, gl.state, &sx, &sy);
+		gl.cam.nx = sx + SHIP_W/2.0;
+		gl.cam.ny = sy + SHIP_H/2.0;
+		/* draws and presents the frame */
+		gl_update_window(time);
+		pacer_wait(&pacer);
 	}
 	
 	// Nettoyage final
 	if (gameController) {
 		SDL_GameControllerClose(gameController);
 	}
+	if (gl.capture)
+		capture_close(gl.capture);
+	sim_free(&sim);
+	trace_stop();
 	sound_free();
 	free_cgl(cgl);
-	SDL_GL_DeleteContext(glContext);
+	if (glContext)
+		SDL_GL_DeleteContext(glContext);
 	SDL_DestroyWindow(window);
 	SDL_Quit();
 	return 0;
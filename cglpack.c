@@ -0,0 +1,232 @@
+/* cglpack.c - packed level archive (CGP) reader and writer
+ * Copyright (C) 2010 Michal Trybus.
+ *
+ * This file is part of FreeCG.
+ *
+ * FreeCG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeCG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeCG. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "cglpack.h"
+#include <SDL2/SDL_error.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#if defined(__unix__) || defined(__APPLE__)
+#define CGP_USE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static inline uint32_t get_u32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+static inline void put_u32(uint8_t *p, uint32_t v)
+{
+	p[0] = v, p[1] = v >> 8, p[2] = v >> 16, p[3] = v >> 24;
+}
+
+/* Maps the whole file (or reads it into memory where mmap is unavailable) */
+static int cgl_pack_map(struct cgl_pack *pack, const char *path)
+{
+#ifdef CGP_USE_MMAP
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		SDL_SetError("open: %s", strerror(errno));
+		return -1;
+	}
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		SDL_SetError("cgp %s is empty or unreadable", path);
+		close(fd);
+		return -1;
+	}
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		SDL_SetError("mmap: %s", strerror(errno));
+		return -1;
+	}
+	pack->data = map;
+	pack->size = st.st_size;
+	pack->mapped = 1;
+	return 0;
+#else
+	FILE *fp = fopen(path, "rb");
+	if (!fp) {
+		SDL_SetError("fopen: %s", strerror(errno));
+		return -1;
+	}
+	(void)fseek(fp, 0, SEEK_END);
+	pack->size = ftell(fp);
+	(void)fseek(fp, 0, SEEK_SET);
+	uint8_t *buf = malloc(pack->size);
+	if (fread(buf, 1, pack->size, fp) < pack->size) {
+		SDL_SetError("fread: %s", strerror(errno));
+		free(buf);
+		fclose(fp);
+		return -1;
+	}
+	fclose(fp);
+	pack->data = buf;
+	pack->mapped = 0;
+	return 0;
+#endif
+}
+
+struct cgl_pack *cgl_pack_open(const char *path)
+{
+	struct cgl_pack *pack = calloc(1, sizeof(*pack));
+	if (cgl_pack_map(pack, path) != 0) {
+		free(pack);
+		return NULL;
+	}
+	if (pack->size < CGP_HDR_SIZE ||
+	    memcmp(pack->data, CGP_MAGIC, CGP_MAGIC_SIZE) != 0) {
+		SDL_SetError("cgp %s header corrupted", path);
+		goto error;
+	}
+	pack->nentries = get_u32(pack->data + 4);
+	uint32_t first = get_u32(pack->data + 8);
+	if (first < CGP_HDR_SIZE + pack->nentries * CGP_ENTRY_SIZE ||
+	    first > pack->size) {
+		SDL_SetError("cgp %s index corrupted", path);
+		goto error;
+	}
+	pack->entries = calloc(pack->nentries, sizeof(*pack->entries));
+	const uint8_t *p = pack->data + CGP_HDR_SIZE;
+	for (size_t i = 0; i < pack->nentries; ++i, p += CGP_ENTRY_SIZE) {
+		struct cgl_pack_entry *e = &pack->entries[i];
+		memcpy(e->name, p, CGP_NAME_SIZE);
+		e->name[CGP_NAME_SIZE] = '\0';
+		e->offset = get_u32(p + 24);
+		e->size   = get_u32(p + 28);
+		e->demo   = p[32] & 0x01;
+		for (size_t k = 0; k < CGP_NUM_COUNTS; ++k)
+			e->counts[k] = get_u32(p + 36 + 4*k);
+		if ((size_t)e->offset + e->size > pack->size) {
+			SDL_SetError("cgp member %s out of bounds", e->name);
+			goto error;
+		}
+	}
+	return pack;
+error:
+	cgl_pack_close(pack);
+	return NULL;
+}
+
+void cgl_pack_close(struct cgl_pack *pack)
+{
+	if (!pack)
+		return;
+#ifdef CGP_USE_MMAP
+	if (pack->mapped)
+		munmap((void*)pack->data, pack->size);
+#endif
+	if (!pack->mapped)
+		free((void*)pack->data);
+	free(pack->entries);
+	free(pack);
+}
+
+/* Level names are compared case-insensitively, the ".CGL" suffix may be
+ * omitted */
+const struct cgl_pack_entry *cgl_pack_find(const struct cgl_pack *pack,
+		const char *name)
+{
+	size_t len = strlen(name);
+	for (size_t i = 0; i < pack->nentries; ++i) {
+		const char *n = pack->entries[i].name;
+		if (strcasecmp(n, name) == 0)
+			return &pack->entries[i];
+		if (strncasecmp(n, name, len) == 0 &&
+		    strcasecmp(n + len, ".cgl") == 0)
+			return &pack->entries[i];
+	}
+	SDL_SetError("cgp: no level named %s", name);
+	return NULL;
+}
+
+/* Returns a stream reading the member directly from the mapping; where
+ * there is no fmemopen, from a temporary copy of it */
+FILE *cgl_pack_fopen(const struct cgl_pack *pack,
+		const struct cgl_pack_entry *e)
+{
+#ifdef CGP_USE_MMAP
+	FILE *fp = fmemopen((void*)cgl_pack_data(pack, e), e->size, "rb");
+	if (!fp)
+		SDL_SetError("fmemopen: %s", strerror(errno));
+	return fp;
+#else
+	FILE *fp = tmpfile();
+	if (!fp) {
+		SDL_SetError("tmpfile: %s", strerror(errno));
+		return NULL;
+	}
+	if (fwrite(cgl_pack_data(pack, e), 1, e->size, fp) < e->size) {
+		SDL_SetError("fwrite: %s", strerror(errno));
+		fclose(fp);
+		return NULL;
+	}
+	rewind(fp);
+	return fp;
+#endif
+}
+
+/* Writes a pack of n members. Offsets of entries are filled in. */
+int cgl_pack_write(FILE *fp, struct cgl_pack_entry *entries,
+		const uint8_t *const data[], size_t n)
+{
+	static const uint8_t zeros[CGP_ALIGN];
+	uint8_t hdr[CGP_HDR_SIZE],
+		ent[CGP_ENTRY_SIZE];
+	size_t off = CGP_HDR_SIZE + n * CGP_ENTRY_SIZE;
+	off = (off + CGP_ALIGN - 1) / CGP_ALIGN * CGP_ALIGN;
+	memcpy(hdr, CGP_MAGIC, CGP_MAGIC_SIZE);
+	put_u32(hdr + 4, n);
+	put_u32(hdr + 8, off);
+	if (fwrite(hdr, 1, CGP_HDR_SIZE, fp) < CGP_HDR_SIZE)
+		goto error;
+	for (size_t i = 0; i < n; ++i) {
+		struct cgl_pack_entry *e = &entries[i];
+		e->offset = off;
+		off = (off + e->size + CGP_ALIGN - 1) / CGP_ALIGN * CGP_ALIGN;
+		memset(ent, 0, sizeof(ent));
+		strncpy((char*)ent, e->name, CGP_NAME_SIZE);
+		put_u32(ent + 24, e->offset);
+		put_u32(ent + 28, e->size);
+		ent[32] = e->demo ? 1 : 0;
+		for (size_t k = 0; k < CGP_NUM_COUNTS; ++k)
+			put_u32(ent + 36 + 4*k, e->counts[k]);
+		if (fwrite(ent, 1, CGP_ENTRY_SIZE, fp) < CGP_ENTRY_SIZE)
+			goto error;
+	}
+	off = CGP_HDR_SIZE + n * CGP_ENTRY_SIZE;
+	for (size_t i = 0; i < n; ++i) {
+		size_t pad = entries[i].offset - off;
+		if (fwrite(zeros, 1, pad, fp) < pad ||
+		    fwrite(data[i], 1, entries[i].size, fp) < entries[i].size)
+			goto error;
+		off = entries[i].offset + entries[i].size;
+	}
+	return 0;
+error:
+	SDL_SetError("fwrite: %s", strerror(errno));
+	return -1;
+}
@@ -0,0 +1,86 @@
+/* cglpack.h - packed level archive (CGP) with a random-access index
+ * Copyright (C) 2010 Michal Trybus.
+ *
+ * This file is part of FreeCG.
+ *
+ * FreeCG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeCG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeCG. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CGLPACK_H
+#define CGLPACK_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define CGP_MAGIC "CGP1"
+enum cgp_sizes {
+	CGP_MAGIC_SIZE = 4,
+	/* magic, number of entries, offset of the first member */
+	CGP_HDR_SIZE = 12,
+	CGP_NAME_SIZE = 24,
+	CGP_ENTRY_SIZE = 80,
+	/* members are aligned to this many bytes */
+	CGP_ALIGN = 16
+};
+/* precomputed object counts of a single member, taken from the level as
+ * returned by read_cgl (before cgl_preprocess) */
+enum cgp_counts {
+	CgpWidth = 0,
+	CgpHeight,
+	CgpTiles,
+	CgpFans,
+	CgpMagnets,
+	CgpAirgens,
+	CgpCannons,
+	CgpBars,
+	CgpGates,
+	CgpLGates,
+	CgpAirports,
+	CGP_NUM_COUNTS
+};
+/* One entry of the index. All the data is already in host byte order. */
+struct cgl_pack_entry {
+	char name[CGP_NAME_SIZE + 1];
+	uint32_t offset,
+		 size;
+	/* 1 if the level works in the unregistered version */
+	int demo;
+	uint32_t counts[CGP_NUM_COUNTS];
+};
+struct cgl_pack {
+	/* the whole file, mapped read-only */
+	const uint8_t *data;
+	size_t size;
+	int mapped;
+	size_t nentries;
+	struct cgl_pack_entry *entries;
+};
+
+struct cgl_pack *cgl_pack_open(const char*);
+void cgl_pack_close(struct cgl_pack*);
+const struct cgl_pack_entry *cgl_pack_find(const struct cgl_pack*,
+		const char*);
+FILE *cgl_pack_fopen(const struct cgl_pack*, const struct cgl_pack_entry*);
+int cgl_pack_write(FILE*, struct cgl_pack_entry*, const uint8_t *const[],
+		size_t);
+
+/* member data pointing directly into the mapping - no copy is made */
+static inline const uint8_t *cgl_pack_data(const struct cgl_pack *pack,
+		const struct cgl_pack_entry *e)
+{
+	return pack->data + e->offset;
+}
+
+#endif
@@ -0,0 +1,458 @@
+/* cglstream.c - on-demand loading of static tiles in chunks of blocks
+ * Copyright (C) 2010 Michal Trybus.
+ *
+ * This file is part of FreeCG.
+ *
+ * FreeCG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeCG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeCG. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cglstream.h"
+#include "cglpack.h"
+#include "cg.h"
+#include "gfx.h"
+#include "mathgeom.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* Reads everything but the static tiles; SOIN and the position of SOBS are
+ * kept to load the chunks later */
+struct cgl *read_cgl_stream(const char *path, size_t n)
+{
+	extern FILE *cgl_fopen(const char*, struct cgl_pack**);
+	extern struct cgl *read_cgl_fp(FILE*, uint8_t**, long*);
+	struct cgl_pack *pack;
+	uint8_t *soin;
+	long sobs;
+	FILE *fp = cgl_fopen(path, &pack);
+	if (!fp)
+		return NULL;
+	struct cgl *cgl = read_cgl_fp(fp, &soin, &sobs);
+	if (!cgl) {
+		fclose(fp);
+		cgl_pack_close(pack);
+		return NULL;
+	}
+	struct cgl_stream *s = calloc(1, sizeof(*s));
+	s->fp = fp;
+	s->pack = pack;
+	s->sobs = sobs;
+	s->soin = soin;
+	s->sw = cgl->width;
+	s->sh = cgl->height;
+	s->n = max(1, n);
+	cgl->stream = s;
+	return cgl;
+}
+
+/* index (in SOBS) of the first tile of block (i, j) */
+static size_t tile_index(const struct cgl_stream *s, size_t i, size_t j)
+{
+	size_t scw = (s->sw + s->n - 1) / s->n,
+	       first = s->seg[j*scw + i/s->n];
+	for (size_t k = i / s->n * s->n; k < i; ++k)
+		first += s->soin[j*s->sw + k];
+	return first;
+}
+
+/* Reads the static tiles of a chunk and builds its block lists. Tiles
+ * anchored up to STREAM_APRON blocks to the left or above may stick into the
+ * chunk, so they are read too (and duplicated in both chunks). */
+static void chunk_load(struct cgl *l, struct cgl_chunk *c, size_t ci, size_t cj)
+{
+	extern void cgl_decode_sobs_tile(const uint8_t*, int, int, struct tile*);
+	struct cgl_stream *s = l->stream;
+	size_t bx0 = ci * s->n,
+	       by0 = cj * s->n,
+	       bx1 = min(bx0 + s->n, l->width),
+	       by1 = min(by0 + s->n, l->height);
+	int px0 = bx0 * BLOCK_SIZE, py0 = by0 * BLOCK_SIZE,
+	    px1 = bx1 * BLOCK_SIZE, py1 = by1 * BLOCK_SIZE;
+	size_t rx0 = bx0 > STREAM_APRON ? bx0 - STREAM_APRON : 0,
+	       ry0 = by0 > STREAM_APRON ? by0 - STREAM_APRON : 0,
+	       rx1 = min(bx1, s->sw),
+	       ry1 = min(by1, s->sh);
+	size_t cap = 0, bufsz = 0;
+	uint8_t *buf = NULL;
+	c->ntiles = 0;
+	c->tiles = NULL;
+	for (size_t j = ry0; j < ry1 && rx0 < rx1; ++j) {
+		size_t count = 0;
+		for (size_t i = rx0; i < rx1; ++i)
+			count += s->soin[j*s->sw + i];
+		if (count == 0)
+			continue;
+		if (count * SOBS_TILE_SIZE > bufsz) {
+			bufsz = count * SOBS_TILE_SIZE;
+			buf = realloc(buf, bufsz);
+		}
+		size_t nread = 0;
+		SDL_LockMutex(s->io);
+		if (fseek(s->fp, s->sobs + SOBS_TILE_SIZE *
+					tile_index(s, rx0, j), SEEK_SET) == 0)
+			nread = fread(buf, SOBS_TILE_SIZE, count, s->fp);
+		SDL_UnlockMutex(s->io);
+		/* a truncated SOBS was already reported by read_cgl */
+		if (nread < count)
+			break;
+		const uint8_t *p = buf;
+		for (size_t i = rx0; i < rx1; ++i) {
+			for (size_t k = 0; k < s->soin[j*s->sw + i];
+					++k, p += SOBS_TILE_SIZE) {
+				struct tile t;
+				memset(&t, 0, sizeof(t));
+				cgl_decode_sobs_tile(p, i * CGL_BLOCK_SIZE,
+						j * CGL_BLOCK_SIZE, &t);
+				if (t.x + t.w <= px0 || t.x >= px1 ||
+				    t.y + t.h <= py0 || t.y >= py1)
+					continue;
+				if (c->ntiles == cap) {
+					cap = cap ? 2*cap : 64;
+					c->tiles = realloc(c->tiles,
+						cap * sizeof(*c->tiles));
+				}
+				c->tiles[c->ntiles++] = t;
+			}
+		}
+	}
+	free(buf);
+	/* count tiles of each block, then fill the lists like cgl_preprocess,
+	 * appending the dynamic tiles already assigned to the block */
+	size_t w = bx1 - bx0,
+	       h = by1 - by0;
+	size_t *sizes = calloc(w * h, sizeof(*sizes));
+	for (size_t k = 0; k < c->ntiles; ++k) {
+		const struct tile *t = &c->tiles[k];
+		for (size_t j = max(by0, t->y / BLOCK_SIZE);
+				j < by1 && (int)(j*BLOCK_SIZE) < t->y + t->h; ++j)
+			for (size_t i = max(bx0, t->x / BLOCK_SIZE);
+					i < bx1 && (int)(i*BLOCK_SIZE) < t->x + t->w; ++i)
+				sizes[(i - bx0) + (j - by0) * w]++;
+	}
+	/* dynamic tiles of the chunk's blocks; the grid may be modified by the
+	 * main thread meanwhile, but not in the blocks of this chunk */
+	c->dyn = calloc(w * h, sizeof(*c->dyn));
+	SDL_LockMutex(s->lock);
+	for (size_t k = 0; k < w * h; ++k)
+		c->dyn[k] = cgl_block(l, bx0 + k % w, by0 + k / w);
+	SDL_UnlockMutex(s->lock);
+	size_t total = 0;
+	for (size_t k = 0; k < w * h; ++k) {
+		size_t ndyn = 0;
+		while (c->dyn[k][ndyn])
+			++ndyn;
+		total += sizes[k] ? sizes[k] + ndyn + 1 : 0;
+	}
+	c->pool = calloc(total, sizeof(*c->pool));
+	c->blocks = calloc(w * h, sizeof(*c->blocks));
+	struct tile **p = c->pool;
+	for (size_t k = 0; k < w * h; ++k) {
+		/* blocks without static tiles keep their list, so that empty
+		 * regions do not allocate super-cells when installed */
+		if (!sizes[k]) {
+			c->blocks[k] = c->dyn[k];
+			continue;
+		}
+		c->blocks[k] = p;
+		p += sizes[k];
+		block d = c->dyn[k];
+		while (*d)
+			*p++ = *d++;
+		*p++ = NULL;
+		/* from now on counts the static tiles already placed */
+		sizes[k] = 0;
+	}
+	for (size_t k = 0; k < c->ntiles; ++k) {
+		struct tile *t = &c->tiles[k];
+		for (size_t j = max(by0, t->y / BLOCK_SIZE);
+				j < by1 && (int)(j*BLOCK_SIZE) < t->y + t->h; ++j)
+			for (size_t i = max(bx0, t->x / BLOCK_SIZE);
+					i < bx1 && (int)(i*BLOCK_SIZE) < t->x + t->w; ++i) {
+				size_t b = (i - bx0) + (j - by0) * w;
+				c->blocks[b][sizes[b]++] = t;
+			}
+	}
+	free(sizes);
+}
+
+static void chunk_install(struct cgl *l, size_t idx)
+{
+	struct cgl_stream *s = l->stream;
+	struct cgl_chunk *c = &s->chunks[idx];
+	size_t bx0 = idx % s->cw * s->n,
+	       by0 = idx / s->cw * s->n,
+	       w = min(bx0 + s->n, l->width) - bx0,
+	       h = min(by0 + s->n, l->height) - by0;
+	for (size_t k = 0; k < w * h; ++k)
+		if (c->blocks[k] != c->dyn[k])
+			*cgl_block_ref(l, bx0 + k % w, by0 + k / w) =
+				c->blocks[k];
+	c->state = ChunkInstalled;
+}
+
+/* uninstalls (if needed) and frees a ready chunk */
+static void chunk_evict(struct cgl *l, size_t idx)
+{
+	struct cgl_stream *s = l->stream;
+	struct cgl_chunk *c = &s->chunks[idx];
+	if (c->state == ChunkInstalled) {
+		size_t bx0 = idx % s->cw * s->n,
+		       by0 = idx / s->cw * s->n,
+		       w = min(bx0 + s->n, l->width) - bx0,
+		       h = min(by0 + s->n, l->height) - by0;
+		for (size_t k = 0; k < w * h; ++k)
+			if (c->blocks[k] != c->dyn[k])
+				*cgl_block_ref(l, bx0 + k % w, by0 + k / w) =
+					c->dyn[k];
+		for (size_t sj = by0 >> GRID_SHIFT;
+				sj <= (by0 + h - 1) >> GRID_SHIFT; ++sj)
+			for (size_t si = bx0 >> GRID_SHIFT;
+					si <= (bx0 + w - 1) >> GRID_SHIFT; ++si)
+				cgl_trim_super(l, si, sj);
+	}
+	free(c->tiles);
+	free(c->blocks);
+	free(c->pool);
+	free(c->dyn);
+	memset(c, 0, sizeof(*c));
+}
+
+static int stream_thread(void *data)
+{
+	struct cgl *l = data;
+	struct cgl_stream *s = l->stream;
+	SDL_LockMutex(s->lock);
+	while (!s->quit) {
+		if (s->qlen == 0) {
+			SDL_CondWait(s->cond, s->lock);
+			continue;
+		}
+		size_t idx = s->queue[s->qhead];
+		s->qhead = (s->qhead + 1) % STREAM_QUEUE_SIZE;
+		--s->qlen;
+		struct cgl_chunk *c = &s->chunks[idx];
+		/* evicted or loaded synchronously in the meantime */
+		if (c->state != ChunkQueued)
+			continue;
+		c->state = ChunkLoading;
+		SDL_UnlockMutex(s->lock);
+		chunk_load(l, c, idx % s->cw, idx / s->cw);
+		SDL_LockMutex(s->lock);
+		c->state = ChunkReady;
+		++s->nloads;
+		SDL_CondBroadcast(s->cond);
+	}
+	SDL_UnlockMutex(s->lock);
+	return 0;
+}
+
+/* Must be called after cgl_preprocess, which fixes the size of the level */
+void cgl_stream_start(struct cgl *l)
+{
+	struct cgl_stream *s = l->stream;
+	if (!s)
+		return;
+	size_t scw = (s->sw + s->n - 1) / s->n;
+	s->seg = calloc(s->sh * scw + 1, sizeof(*s->seg));
+	uint32_t first = 0;
+	for (size_t j = 0; j < s->sh; ++j)
+		for (size_t i = 0; i < s->sw; ++i) {
+			if (i % s->n == 0)
+				s->seg[j*scw + i/s->n] = first;
+			first += s->soin[j*s->sw + i];
+		}
+	s->cw = (l->width + s->n - 1) / s->n;
+	s->ch = (l->height + s->n - 1) / s->n;
+	s->chunks = calloc(s->cw * s->ch, sizeof(*s->chunks));
+	s->resident = calloc(s->cw * s->ch, sizeof(*s->resident));
+	s->lock = SDL_CreateMutex();
+	s->io = SDL_CreateMutex();
+	s->cond = SDL_CreateCond();
+	s->thread = SDL_CreateThread(stream_thread, "cgl_stream", l);
+	if (!s->thread)
+		fprintf(stderr, "cgl_stream: %s, loading synchronously\n",
+				SDL_GetError());
+}
+
+/* range of chunks covering a rectangle given in px */
+struct chunk_range {
+	int x0, y0, x1, y1;
+};
+static struct chunk_range chunk_range(const struct cgl_stream *s,
+		double x, double y, double w, double h, int grow)
+{
+	double side = s->n * BLOCK_SIZE;
+	struct chunk_range r = {
+		.x0 = max(0, (int)floor(x / side) - grow),
+		.y0 = max(0, (int)floor(y / side) - grow),
+		.x1 = min(s->cw - 1, (int)floor((x + w) / side) + grow),
+		.y1 = min(s->ch - 1, (int)floor((y + h) / side) + grow)
+	};
+	return r;
+}
+static int chunk_dist(const struct chunk_range *r, int ci, int cj)
+{
+	int dx = ci < r->x0 ? r->x0 - ci : ci > r->x1 ? ci - r->x1 : 0,
+	    dy = cj < r->y0 ? r->y0 - cj : cj > r->y1 ? cj - r->y1 : 0;
+	return max(dx, dy);
+}
+static void chunk_add_resident(struct cgl_stream *s, size_t idx)
+{
+	s->resident[s->nresident++] = idx;
+}
+/* makes sure the chunk is installed, loading it if necessary; the lock
+ * must be held */
+static void chunk_ensure(struct cgl *l, size_t idx)
+{
+	struct cgl_stream *s = l->stream;
+	struct cgl_chunk *c = &s->chunks[idx];
+	switch (c->state) {
+	case ChunkEmpty:
+		chunk_add_resident(s, idx);
+		/* fall through */
+	case ChunkQueued:
+		c->state = ChunkLoading;
+		SDL_UnlockMutex(s->lock);
+		chunk_load(l, c, idx % s->cw, idx / s->cw);
+		SDL_LockMutex(s->lock);
+		c->state = ChunkReady;
+		++s->nloads;
+		++s->nsync_loads;
+		break;
+	case ChunkLoading:
+		while (c->state == ChunkLoading)
+			SDL_CondWait(s->cond, s->lock);
+		++s->nsync_loads;
+		break;
+	default:
+		break;
+	}
+	if (c->state == ChunkReady)
+		chunk_install(l, idx);
+}
+static void chunk_prefetch(struct cgl_stream *s, size_t idx)
+{
+	struct cgl_chunk *c = &s->chunks[idx];
+	if (c->state != ChunkEmpty || s->qlen == STREAM_QUEUE_SIZE)
+		return;
+	c->state = ChunkQueued;
+	chunk_add_resident(s, idx);
+	s->queue[(s->qhead + s->qlen++) % STREAM_QUEUE_SIZE] = idx;
+}
+
+/* Called once per frame, before the simulation step. Chunks under the view
+ * and around the ship are loaded synchronously, those next to them and
+ * along the direction of flight are prefetched, far ones are evicted. */
+void cgl_stream_update(struct cgl *l, const struct drect *view)
+{
+	struct cgl_stream *s = l->stream;
+	if (!s || !s->chunks)
+		return;
+	const struct ship *ship = l->ship;
+	struct chunk_range vr = chunk_range(s, view->x, view->y,
+			view->w, view->h, 0),
+			   sr = chunk_range(s, ship->x - 2*BLOCK_SIZE,
+			ship->y - 2*BLOCK_SIZE, SHIP_W + 4*BLOCK_SIZE,
+			SHIP_H + 4*BLOCK_SIZE, 0),
+			   pr = chunk_range(s, view->x, view->y,
+			view->w, view->h, STREAM_PREFETCH_RING),
+			   ar = chunk_range(s,
+			view->x + ship->vx * STREAM_LOOKAHEAD,
+			view->y + ship->vy * STREAM_LOOKAHEAD,
+			view->w, view->h, STREAM_PREFETCH_RING);
+	SDL_LockMutex(s->lock);
+	/* evict first, so that the list of resident chunks stays short */
+	for (size_t k = 0; k < s->nresident; ) {
+		size_t idx = s->resident[k];
+		struct cgl_chunk *c = &s->chunks[idx];
+		int ci = idx % s->cw,
+		    cj = idx / s->cw;
+		if (c->state == ChunkLoading ||
+		    chunk_dist(&vr, ci, cj) <= STREAM_EVICT_DIST ||
+		    chunk_dist(&sr, ci, cj) <= STREAM_EVICT_DIST) {
+			++k;
+			continue;
+		}
+		if (c->state == ChunkQueued)
+			c->state = ChunkEmpty;
+		else
+			chunk_evict(l, idx);
+		++s->nevictions;
+		s->resident[k] = s->resident[--s->nresident];
+	}
+	const struct chunk_range *need[] = {&sr, &vr},
+				 *fetch[] = {&ar, &pr};
+	for (size_t r = 0; r < ARRSZ(need); ++r)
+		for (int cj = need[r]->y0; cj <= need[r]->y1; ++cj)
+			for (int ci = need[r]->x0; ci <= need[r]->x1; ++ci)
+				chunk_ensure(l, ci + cj * s->cw);
+	size_t queued = s->qlen;
+	for (size_t r = 0; r < ARRSZ(fetch); ++r)
+		for (int cj = fetch[r]->y0; cj <= fetch[r]->y1; ++cj)
+			for (int ci = fetch[r]->x0; ci <= fetch[r]->x1; ++ci)
+				chunk_prefetch(s, ci + cj * s->cw);
+	/* install whatever the loader has finished */
+	for (size_t k = 0; k < s->nresident; ++k)
+		if (s->chunks[s->resident[k]].state == ChunkReady)
+			chunk_install(l, s->resident[k]);
+	if (s->qlen > queued)
+		SDL_CondBroadcast(s->cond);
+	SDL_UnlockMutex(s->lock);
+	/* without the loader thread nothing is prefetched */
+	if (!s->thread) {
+		SDL_LockMutex(s->lock);
+		while (s->qlen > 0) {
+			size_t idx = s->queue[s->qhead];
+			s->qhead = (s->qhead + 1) % STREAM_QUEUE_SIZE;
+			--s->qlen;
+			s->chunks[idx].state = ChunkEmpty;
+			for (size_t k = 0; k < s->nresident; ++k)
+				if (s->resident[k] == idx) {
+					s->resident[k] =
+						s->resident[--s->nresident];
+					break;
+				}
+		}
+		SDL_UnlockMutex(s->lock);
+	}
+}
+
+void cgl_stream_close(struct cgl *l)
+{
+	struct cgl_stream *s = l->stream;
+	if (!s)
+		return;
+	if (s->thread) {
+		SDL_LockMutex(s->lock);
+		s->quit = 1;
+		SDL_CondBroadcast(s->cond);
+		SDL_UnlockMutex(s->lock);
+		SDL_WaitThread(s->thread, NULL);
+	}
+	for (size_t k = 0; k < s->nresident; ++k)
+		chunk_evict(l, s->resident[k]);
+	if (s->lock) {
+		SDL_DestroyMutex(s->lock);
+		SDL_DestroyMutex(s->io);
+		SDL_DestroyCond(s->cond);
+	}
+	fclose(s->fp);
+	cgl_pack_close(s->pack);
+	free(s->soin);
+	free(s->seg);
+	free(s->chunks);
+	free(s->resident);
+	free(s);
+	l->stream = NULL;
+}
@@ -0,0 +1,93 @@
+/* cglstream.h - on-demand loading of static tiles in chunks of blocks
+ * Copyright (C) 2010 Michal Trybus.
+ *
+ * This file is part of FreeCG.
+ *
+ * FreeCG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeCG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeCG. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CGLSTREAM_H
+#define CGLSTREAM_H
+
+#include "cgl.h"
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_thread.h>
+
+/*
+ * A streamed level keeps only the dynamic objects in cgl->tiles. Static
+ * (SOBS) tiles are read from the level file in chunks of n x n blocks when
+ * the camera or the ship approaches them. A loaded chunk is installed in
+ * the grid of blocks: its block lists contain both its static tiles and the
+ * dynamic tiles of the block, so cgl_block() needs no special case.
+ */
+enum stream_config {
+	/* chunks prefetched around the visible ones */
+	STREAM_PREFETCH_RING = 1,
+	/* chunks farther than this from the view and the ship are evicted */
+	STREAM_EVICT_DIST = 3,
+	STREAM_QUEUE_SIZE = 256,
+	/* tiles stick out of their block by up to this many blocks */
+	STREAM_APRON = 3
+};
+/* seconds of flight, along which chunks are prefetched */
+#define STREAM_LOOKAHEAD 1.0
+enum chunk_state {
+	ChunkEmpty = 0,
+	ChunkQueued,
+	ChunkLoading,
+	ChunkReady,
+	ChunkInstalled
+};
+struct cgl_chunk {
+	enum chunk_state state;
+	size_t ntiles;
+	struct tile *tiles;
+	/* block lists of the chunk, row by row, and their storage */
+	block *blocks;
+	struct tile **pool;
+	/* block lists with dynamic tiles only, replaced while installed */
+	block *dyn;
+};
+struct cgl_stream {
+	FILE *fp;
+	struct cgl_pack *pack;
+	long sobs;
+	/* SOIN and the size of the level as stored in the file */
+	uint8_t *soin;
+	size_t sw, sh;
+	/* index of the first SOBS tile of each row of each column of chunks */
+	uint32_t *seg;
+	size_t n;
+	size_t cw, ch;
+	struct cgl_chunk *chunks;
+	/* installed or ready chunks */
+	size_t *resident;
+	size_t nresident;
+	size_t queue[STREAM_QUEUE_SIZE];
+	size_t qhead, qlen;
+	int quit;
+	SDL_Thread *thread;
+	SDL_mutex *lock,
+		  *io;
+	SDL_cond *cond;
+	/* statistics */
+	size_t nloads, nsync_loads, nevictions;
+};
+
+struct cgl *read_cgl_stream(const char*, size_t);
+void cgl_stream_start(struct cgl*);
+void cgl_stream_update(struct cgl*, const struct drect*);
+void cgl_stream_close(struct cgl*);
+
+#endif
@@ -0,0 +1,123 @@
+/* drawlist.c - what a frame draws, between scene traversal and GL
+ * Copyright (C) 2010 Michal Trybus.
+ *
+ * This file is part of FreeCG.
+ *
+ * FreeCG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeCG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeCG. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "drawlist.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Keeps the storage for the next frame */
+void dl_clear(struct drawlist *dl)
+{
+	dl->npasses = dl->nrecs = 0;
+	dl->overlay = (size_t)-1;
+}
+
+/* Starts a pass; sprites added until the next one belong to it */
+void dl_pass(struct drawlist *dl, enum pass_kind kind,
+		const struct drect *view)
+{
+	if (dl->npasses == dl->passes_size) {
+		dl->passes_size = dl->passes_size ? 2 * dl->passes_size : 8;
+		dl->passes = realloc(dl->passes,
+				dl->passes_size * sizeof(*dl->passes));
+	}
+	struct draw_pass *p = &dl->passes[dl->npasses++];
+	p->kind = kind;
+	p->view = *view;
+	p->first = dl->nrecs;
+	p->count = 0;
+}
+
+/* Passes started from now on are the overlay */
+void dl_overlay(struct drawlist *dl)
+{
+	dl->overlay = dl->npasses;
+}
+
+/* Rectangle (x, y, w, h) in layer z, showing the given part of the image of
+ * tm with opacity a */
+void dl_sprite(struct drawlist *dl, struct texmgr *tm, double x,
+		double y, double w, double h, double z, int tex_x, int tex_y,
+		int tex_w, int tex_h, double a)
+{
+	assert(dl->npasses > 0);
+	if (dl->nrecs == dl->recs_size) {
+		dl->recs_size = dl->recs_size ? 2 * dl->recs_size : 256;
+		dl->recs = realloc(dl->recs,
+				dl->recs_size * sizeof(*dl->recs));
+	}
+	dl->recs[dl->nrecs++] = (struct draw_rec){
+		.tm = tm,
+		.x = x, .y = y, .w = w, .h = h,
+		.z = z, .a = a,
+		.tex_x = tex_x, .tex_y = tex_y,
+		.tex_w = tex_w, .tex_h = tex_h
+	};
+	dl->passes[dl->npasses - 1].count++;
+}
+
+struct sort_key {
+	float z;
+	GLuint texno;
+	size_t idx;
+};
+/* bottom to top, then by texture; equal ones are drawn in the reverse order
+ * of traversal, as the first of overlapping tiles stays on top */
+static int cmp_sort_key(const void *a, const void *b)
+{
+	const struct sort_key *ka = a, *kb = b;
+	if (ka->z != kb->z)
+		return ka->z < kb->z ? -1 : 1;
+	if (ka->texno != kb->texno)
+		return ka->texno < kb->texno ? -1 : 1;
+	return ka->idx > kb->idx ? -1 : ka->idx < kb->idx;
+}
+/* Orders the sprites of each pass for batching */
+void dl_sort(struct drawlist *dl)
+{
+	size_t n = 0;
+	for (size_t p = 0; p < dl->npasses; ++p)
+		if (dl->passes[p].count > n)
+			n = dl->passes[p].count;
+	if (n < 2)
+		return;
+	struct sort_key *keys = malloc(n * sizeof(*keys));
+	struct draw_rec *tmp = malloc(n * sizeof(*tmp));
+	for (size_t p = 0; p < dl->npasses; ++p) {
+		struct draw_rec *recs = dl->recs + dl->passes[p].first;
+		size_t count = dl->passes[p].count;
+		for (size_t k = 0; k < count; ++k)
+			keys[k] = (struct sort_key){recs[k].z,
+				recs[k].tm->texno, k};
+		qsort(keys, count, sizeof(*keys), cmp_sort_key);
+		for (size_t k = 0; k < count; ++k)
+			tmp[k] = recs[keys[k].idx];
+		memcpy(recs, tmp, count * sizeof(*recs));
+	}
+	free(tmp);
+	free(keys);
+}
+
+void dl_free(struct drawlist *dl)
+{
+	free(dl->passes);
+	free(dl->recs);
+	memset(dl, 0, sizeof(*dl));
+}
@@ -0,0 +1,76 @@
+/* drawlist.h - what a frame draws, between scene traversal and GL
+ * Copyright (C) 2010 Michal Trybus.
+ *
+ * This file is part of FreeCG.
+ *
+ * FreeCG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeCG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeCG. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DRAWLIST_H
+#define DRAWLIST_H
+
+#include "mathgeom.h"
+#include "texmgr.h"
+#include <stddef.h>
+
+/*
+ * The scene and the OSD are traversed into a list of passes without calling
+ * GL; a renderer then submits the list. Sprite passes hold textured
+ * rectangles; the other kinds stand for geometry the renderer keeps in its
+ * own buffers.
+ * Nothing is depth tested: passes are drawn in order, and the sprites of a
+ * pass from the lowest z (an enum layer for tiles) to the highest.
+ */
+enum pass_kind {
+	PassSprites = 0,
+	/* chunks of static tiles from the cache, given as sprites */
+	PassCache,
+	/* static and dynamic tiles in vertex buffers */
+	PassStatic,
+	PassDynamic
+};
+struct draw_pass {
+	enum pass_kind kind;
+	/* the part of the plane shown in the window, in px */
+	struct drect view;
+	/* sprites of the pass */
+	size_t first, count;
+};
+struct draw_rec {
+	struct texmgr *tm;
+	float x, y, w, h;
+	float z, a;
+	short tex_x, tex_y, tex_w, tex_h;
+};
+struct drawlist {
+	struct draw_pass *passes;
+	size_t npasses, passes_size;
+	struct draw_rec *recs;
+	size_t nrecs, recs_size;
+	/* time of the simulation, which drives blinking and animations */
+	double time;
+	/* passes from this one on are drawn over the scaled-up scene, at the
+	 * resolution of the window */
+	size_t overlay;
+};
+
+void dl_clear(struct drawlist*);
+void dl_pass(struct drawlist*, enum pass_kind, const struct drect*);
+void dl_overlay(struct drawlist*);
+void dl_sprite(struct drawlist*, struct texmgr*, double, double,
+		double, double, double, int, int, int, int, double);
+void dl_sort(struct drawlist*);
+void dl_free(struct drawlist*);
+
+#endif
@@ -0,0 +1,394 @@
+/* gl33.c - OpenGL 3.3 core profile renderer drawing tiles as instances
+ * Copyright (C) 2010 Michal Trybus.
+ *
+ * This file is part of FreeCG.
+ *
+ * FreeCG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeCG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeCG. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gl33.h"
+#include "graphics.h"
+#include <stddef.h>
+#include <string.h>
+
+static const char *tile_vs =
+	"#version 330 core\n"
+	"layout(location = 0) in vec2 a_pos;\n"
+	"layout(location = 1) in vec2 a_size;\n"
+	"layout(location = 2) in vec2 a_tex;\n"
+	"layout(location = 3) in uvec2 a_anim;\n"
+	"uniform mat4 u_mvp;\n"
+	"uniform vec2 u_texsize;\n"
+	"uniform float u_time;\n"
+	/* NUM_ANIMS speeds, [0] is that of blinking */
+	"uniform float u_speed[7];\n"
+	"out vec2 v_uv;\n"
+	"int phase(uint k) { return int(floor(u_time * u_speed[k] + 0.5)); }\n"
+	/* the frame orders of the animators in cg.c */
+	"int frame(uint kind, int p) {\n"
+	"	switch (kind) {\n"
+	"	case 1u: return p % 3;\n"
+	"	case 2u: p %= 4; return p == 3 ? 1 : p;\n"
+	"	case 3u: case 6u: return p % 8;\n"
+	"	case 4u: return p % 2;\n"
+	"	case 5u: return 1 - p % 2;\n"
+	"	}\n"
+	"	return 0;\n"
+	"}\n"
+	"void main() {\n"
+	"	uint flags = a_anim.x, kind = flags >> 2u;\n"
+	"	if ((flags & 1u) != 0u ||\n"
+	"	    ((flags & 2u) != 0u && phase(0u) % 2 != 0)) {\n"
+	"		gl_Position = vec4(2.0, 2.0, 2.0, 1.0);\n"
+	"		v_uv = vec2(0.0);\n"
+	"		return;\n"
+	"	}\n"
+	"	vec2 corner = vec2(gl_VertexID >> 1, gl_VertexID & 1);\n"
+	"	vec2 tex = a_tex;\n"
+	"	if (kind != 0u)\n"
+	"		tex.x += float(frame(kind, phase(kind)) * int(a_anim.y));\n"
+	"	v_uv = (tex + corner * a_size) / u_texsize;\n"
+	"	gl_Position = u_mvp * vec4(a_pos + corner * a_size, 0.0, 1.0);\n"
+	"}\n";
+static const char *tile_fs =
+	"#version 330 core\n"
+	"uniform sampler2D u_tex;\n"
+	"in vec2 v_uv;\n"
+	"out vec4 color;\n"
+	"void main() { color = texture(u_tex, v_uv); }\n";
+static const char *osd_vs =
+	"#version 330 core\n"
+	"layout(location = 0) in vec2 a_pos;\n"
+	"layout(location = 1) in vec2 a_uv;\n"
+	"layout(location = 2) in float a_alpha;\n"
+	"uniform mat4 u_mvp;\n"
+	"out vec2 v_uv;\n"
+	"out float v_alpha;\n"
+	"void main() {\n"
+	"	v_uv = a_uv;\n"
+	"	v_alpha = a_alpha;\n"
+	"	gl_Position = u_mvp * vec4(a_pos, 0.0, 1.0);\n"
+	"}\n";
+static const char *osd_fs =
+	"#version 330 core\n"
+	"uniform sampler2D u_tex;\n"
+	"in vec2 v_uv;\n"
+	"in float v_alpha;\n"
+	"out vec4 color;\n"
+	"void main() { color = texture(u_tex, v_uv) * vec4(1, 1, 1, v_alpha); }\n";
+
+struct program {
+	GLuint id;
+	GLint mvp, texsize, time, speed;
+};
+/* per dynamic tile: how its texture cycles */
+struct anim {
+	unsigned char kind;
+	short base, step;
+};
+static struct {
+	struct program tiles, osd;
+	GLuint vao;
+	struct texmgr *ttm;
+	struct vbo_static statics;
+	struct vbo_dynamic dynamics;
+	struct tile *dyn;
+	struct anim *anims;
+	size_t nanims;
+	GLfloat mvp[16];
+	/* quads of the current batch */
+	GLuint quad_buf;
+	struct gl33_vertex *quads;
+	size_t nquads, quads_size;
+	struct texmgr *quad_tm;
+} g33;
+
+static GLuint build_shader(GLenum type, const char *src)
+{
+	GLuint s = glCreateShader(type);
+	GLint ok;
+	glShaderSource(s, 1, &src, NULL);
+	glCompileShader(s);
+	glGetShaderiv(s, GL_COMPILE_STATUS, &ok);
+	if (!ok) {
+		char log[512];
+		glGetShaderInfoLog(s, sizeof(log), NULL, log);
+		SDL_SetError("shader: %s", log);
+		glDeleteShader(s);
+		return 0;
+	}
+	return s;
+}
+static int build_program(struct program *p, const char *vs_src, const char *fs_src)
+{
+	GLuint vs = build_shader(GL_VERTEX_SHADER, vs_src),
+	       fs = vs ? build_shader(GL_FRAGMENT_SHADER, fs_src) : 0;
+	GLint ok = 0;
+	if (!fs) {
+		glDeleteShader(vs);
+		return -1;
+	}
+	p->id = glCreateProgram();
+	glAttachShader(p->id, vs);
+	glAttachShader(p->id, fs);
+	glLinkProgram(p->id);
+	glDeleteShader(vs);
+	glDeleteShader(fs);
+	glGetProgramiv(p->id, GL_LINK_STATUS, &ok);
+	if (!ok) {
+		char log[512];
+		glGetProgramInfoLog(p->id, sizeof(log), NULL, log);
+		SDL_SetError("shader program: %s", log);
+		return -1;
+	}
+	p->mvp = glGetUniformLocation(p->id, "u_mvp");
+	p->texsize = glGetUniformLocation(p->id, "u_texsize");
+	p->time = glGetUniformLocation(p->id, "u_time");
+	p->speed = glGetUniformLocation(p->id, "u_speed");
+	glUseProgram(p->id);
+	glUniform1i(glGetUniformLocation(p->id, "u_tex"), 0);
+	return 0;
+}
+
+static void emit_instance(struct gl33_instance *in, double x, double y,
+		const struct tile *t)
+{
+	in->x = x, in->y = y;
+	in->w = t->w, in->h = t->h;
+	in->tex_x = g33.ttm->x + t->tex_x;
+	in->tex_y = g33.ttm->y + t->tex_y;
+	in->flags = in->step = 0;
+}
+/* tiles of the buffers are drawn whatever their type */
+static void emit_tile(struct gl33_instance *in, const struct tile *t)
+{
+	emit_instance(in, t->x, t->y, t);
+	in->flags = t->type == Transparent ? G33_HIDDEN :
+		t->type == Blink ? G33_BLINK : 0;
+}
+static void emit_static(void *rec, const struct tile *t,
+		__attribute__((unused)) const void *data)
+{
+	emit_tile(rec, t);
+}
+static void emit_dynamic(void *rec, const struct tile *t,
+		__attribute__((unused)) const void *data)
+{
+	struct gl33_instance *in = rec;
+	const struct anim *a = &g33.anims[t - g33.dyn];
+	emit_tile(in, t);
+	if (a->kind != AnimNone) {
+		in->tex_x = g33.ttm->x + a->base;
+		in->step = a->step;
+		in->flags |= a->kind << G33_KIND_SHIFT;
+	}
+}
+static void set_anim(struct tile *t, enum gl33_anim kind, int base, int step)
+{
+	if (t < g33.dyn || t >= g33.dyn + g33.nanims)
+		return;
+	g33.anims[t - g33.dyn] = (struct anim){kind, base, step};
+	t->anim_on_gpu = 1;
+}
+static void find_anims(const struct cgl *l)
+{
+	g33.dyn = l->tiles + l->nstatic;
+	g33.nanims = l->ntiles - l->nstatic;
+	g33.anims = calloc(g33.nanims + 1, sizeof(*g33.anims));
+	for (size_t i = 0; i < l->nfans; ++i)
+		set_anim(l->fans[i].base, AnimFan, l->fans[i].tex_x,
+				l->fans[i].base->w);
+	for (size_t i = 0; i < l->nmagnets; ++i)
+		set_anim(l->magnets[i].magn, AnimMagnet, l->magnets[i].tex_x,
+				l->magnets[i].magn->w);
+	for (size_t i = 0; i < l->nairgens; ++i)
+		set_anim(l->airgens[i].base, AnimAirgen, l->airgens[i].tex_x,
+				l->airgens[i].base->w);
+	for (size_t i = 0; i < l->nbars; ++i) {
+		set_anim(l->bars[i].beg, AnimBarBeg, l->bars[i].btex_x,
+				BAR_TEX_OFFSET);
+		set_anim(l->bars[i].end, AnimBarEnd, l->bars[i].etex_x,
+				BAR_TEX_OFFSET);
+	}
+	for (size_t i = 0; i < l->nairports; ++i)
+		if (l->airports[i].type == Key)
+			set_anim(l->airports[i].cargo[0], AnimKey, KEY_TEX_X,
+					l->airports[i].cargo[0]->w);
+}
+
+/* Points the instance attributes at the record first of the bound buffer */
+static void instance_attribs(GLint first)
+{
+	const size_t s = sizeof(struct gl33_instance);
+	const char *base = (const char*)(first * s);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, s,
+			base + offsetof(struct gl33_instance, x));
+	glVertexAttribPointer(1, 2, GL_UNSIGNED_SHORT, GL_FALSE, s,
+			base + offsetof(struct gl33_instance, w));
+	glVertexAttribPointer(2, 2, GL_SHORT, GL_FALSE, s,
+			base + offsetof(struct gl33_instance, tex_x));
+	glVertexAttribIPointer(3, 2, GL_UNSIGNED_SHORT, s,
+			base + offsetof(struct gl33_instance, flags));
+}
+static void draw_instances(GLint first, GLsizei count,
+		__attribute__((unused)) void *data)
+{
+	instance_attribs(first);
+	glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count);
+	++gl.counting.calls;
+}
+static void use_tiles(double time)
+{
+	static const GLfloat speed[NUM_ANIMS] = {
+		[AnimNone] = BLINK_SPEED,
+		[AnimFan] = FAN_ANIM_SPEED,
+		[AnimMagnet] = MAGNET_ANIM_SPEED,
+		[AnimAirgen] = AIRGEN_ANIM_SPEED,
+		[AnimBarBeg] = BAR_ANIM_SPEED,
+		[AnimBarEnd] = BAR_ANIM_SPEED,
+		[AnimKey] = KEY_ANIM_SPEED
+	};
+	glUseProgram(g33.tiles.id);
+	glUniformMatrix4fv(g33.tiles.mvp, 1, GL_FALSE, g33.mvp);
+	glUniform2f(g33.tiles.texsize, g33.ttm->w, g33.ttm->h);
+	glUniform1f(g33.tiles.time, time);
+	glUniform1fv(g33.tiles.speed, NUM_ANIMS, speed);
+	gl_bind_texture(g33.ttm);
+	for (GLuint i = 0; i < 4; ++i) {
+		glEnableVertexAttribArray(i);
+		glVertexAttribDivisor(i, 1);
+	}
+}
+
+/* dyn are the copies of the dynamic tiles drawn (see interp.h); returns -1
+ * if the shaders could not be built */
+int gl33_init(struct cgl *l, struct tile *dyn, struct texmgr *ttm)
+{
+	if (build_program(&g33.tiles, tile_vs, tile_fs) < 0 ||
+	    build_program(&g33.osd, osd_vs, osd_fs) < 0)
+		return -1;
+	g33.ttm = ttm;
+	glGenVertexArrays(1, &g33.vao);
+	glBindVertexArray(g33.vao);
+	glGenBuffers(1, &g33.quad_buf);
+	vbo_static_build_with(&g33.statics, l, sizeof(struct gl33_instance), 1,
+			emit_static, NULL);
+	find_anims(l);
+	/* the anims of the tiles of l are those of their copies */
+	g33.dyn = dyn;
+	vbo_dynamic_build_with(&g33.dynamics, dyn, g33.nanims,
+			sizeof(struct gl33_instance), 1, emit_dynamic, NULL);
+	return 0;
+}
+
+/* The view (in px) maps to the whole window */
+void gl33_set_view(const struct drect *view)
+{
+	memset(g33.mvp, 0, sizeof(g33.mvp));
+	/* as the projection of gl_resize_viewport */
+	g33.mvp[0] = 2 / view->w;
+	g33.mvp[5] = -2 / view->h;
+	g33.mvp[12] = -2 * view->x / view->w - 1;
+	g33.mvp[13] = 2 * view->y / view->h + 1;
+	g33.mvp[15] = 1;
+}
+
+/* Time is that of the simulation, which drives blinking and animations */
+void gl33_draw_static(const struct drect *view, double time)
+{
+	if (!g33.statics.buf)
+		return;
+	use_tiles(time);
+	glBindBuffer(GL_ARRAY_BUFFER, g33.statics.buf);
+	vbo_static_visible(&g33.statics, view, draw_instances, NULL);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+void gl33_draw_dynamic(double time)
+{
+	vbo_dynamic_update_with(&g33.dynamics, NULL, 0);
+	if (!g33.dynamics.buf)
+		return;
+	use_tiles(time);
+	glBindBuffer(GL_ARRAY_BUFFER, g33.dynamics.buf);
+	draw_instances(0, g33.dynamics.ntiles, NULL);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+/* A sprite or OSD element: rectangle (x, y, w, h) showing the given part of
+ * the texture with opacity a */
+void gl33_quad(struct texmgr *tm, double x, double y, double w, double h,
+		int tex_x, int tex_y, int tex_w, int tex_h, double a)
+{
+	if (g33.quad_tm != tm)
+		gl33_flush();
+	g33.quad_tm = tm;
+	if (g33.nquads + 6 > g33.quads_size) {
+		g33.quads_size = g33.quads_size ? 2 * g33.quads_size : 384;
+		g33.quads = realloc(g33.quads,
+				g33.quads_size * sizeof(*g33.quads));
+	}
+	GLfloat u0 = (tm->x + tex_x) / tm->w,
+		v0 = (tm->y + tex_y) / tm->h,
+		u1 = (tm->x + tex_x + tex_w) / tm->w,
+		v1 = (tm->y + tex_y + tex_h) / tm->h;
+	struct gl33_vertex tl = {x, y, u0, v0, a},
+			   bl = {x, y + h, u0, v1, a},
+			   br = {x + w, y + h, u1, v1, a},
+			   tr = {x + w, y, u1, v0, a};
+	struct gl33_vertex *v = &g33.quads[g33.nquads];
+	v[0] = tl, v[1] = bl, v[2] = br;
+	v[3] = tl, v[4] = br, v[5] = tr;
+	g33.nquads += 6;
+}
+/* Draws the pending quads */
+void gl33_flush(void)
+{
+	if (g33.nquads) {
+		const size_t s = sizeof(struct gl33_vertex);
+		glUseProgram(g33.osd.id);
+		glUniformMatrix4fv(g33.osd.mvp, 1, GL_FALSE, g33.mvp);
+		gl_bind_texture(g33.quad_tm);
+		glBindBuffer(GL_ARRAY_BUFFER, g33.quad_buf);
+		glBufferData(GL_ARRAY_BUFFER, g33.nquads * s, g33.quads,
+				GL_STREAM_DRAW);
+		for (GLuint i = 0; i < 3; ++i) {
+			glEnableVertexAttribArray(i);
+			glVertexAttribDivisor(i, 0);
+		}
+		glDisableVertexAttribArray(3);
+		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, s,
+				(const GLvoid*)offsetof(struct gl33_vertex, x));
+		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, s,
+				(const GLvoid*)offsetof(struct gl33_vertex, u));
+		glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, s,
+				(const GLvoid*)offsetof(struct gl33_vertex, a));
+		glDrawArrays(GL_TRIANGLES, 0, g33.nquads);
+		++gl.counting.calls;
+		g33.nquads = 0;
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void gl33_free(void)
+{
+	vbo_static_free(&g33.statics);
+	vbo_dynamic_free(&g33.dynamics);
+	glDeleteBuffers(1, &g33.quad_buf);
+	glDeleteVertexArrays(1, &g33.vao);
+	glDeleteProgram(g33.tiles.id);
+	glDeleteProgram(g33.osd.id);
+	free(g33.anims);
+	free(g33.quads);
+	memset(&g33, 0, sizeof(g33));
+}
@@ -0,0 +1,75 @@
+/* gl33.h - OpenGL 3.3 core profile renderer drawing tiles as instances
+ * Copyright (C) 2010 Michal Trybus.
+ *
+ * This file is part of FreeCG.
+ *
+ * FreeCG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeCG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeCG. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GL33_H
+#define GL33_H
+
+#include "cgl.h"
+#include "texmgr.h"
+#include "glvbo.h"
+#include <SDL2/SDL_opengl.h>
+
+/*
+ * Every tile is a single instance of a 4-vertex triangle strip. The vertex
+ * shader expands it and evaluates blinking and the texture cycling of fans,
+ * magnets, airgens, bars and keys from the time uniform. The simulation
+ * still animates the tiles, whose frames the collisions depend on, but the
+ * new frames are not uploaded (see tile->anim_on_gpu).
+ */
+enum gl33_flags {
+	G33_HIDDEN = 1,
+	G33_BLINK = 2,
+	/* the animation kind is stored above the flags */
+	G33_KIND_SHIFT = 2
+};
+enum gl33_anim {
+	AnimNone = 0,
+	AnimFan,
+	AnimMagnet,
+	AnimAirgen,
+	AnimBarBeg,
+	AnimBarEnd,
+	AnimKey,
+	NUM_ANIMS
+};
+/* 20 bytes per tile; tex_x of animated tiles is the first frame and step
+ * the distance between frames */
+struct gl33_instance {
+	GLfloat x, y;
+	GLushort w, h;
+	GLshort tex_x, tex_y;
+	GLushort flags, step;
+};
+/* vertex of an OSD element */
+struct gl33_vertex {
+	GLfloat x, y;
+	GLfloat u, v;
+	GLfloat a;
+};
+
+int gl33_init(struct cgl*, struct tile*, struct texmgr*);
+void gl33_set_view(const struct drect*);
+void gl33_draw_static(const struct drect*, double);
+void gl33_draw_dynamic(double);
+void gl33_quad(struct texmgr*, double, double, double, double,
+		int, int, int, int, double);
+void gl33_flush(void);
+void gl33_free(void);
+
+#endif
@@ -0,0 +1,198 @@
+/* glcache.c - static scenery pre-rendered into textures of chunks
+ * Copyright (C) 2010 Michal Trybus.
+ *
+ * This file is part of FreeCG.
+ *
+ * FreeCG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeCG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeCG. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "glcache.h"
+#include "graphics.h"
+#include "mathgeom.h"
+#include <math.h>
+#include <string.h>
+
+#define CHUNK_PX (CACHE_CHUNK * BLOCK_SIZE)
+
+void glcache_init(struct glcache *gc, const struct cgl *l)
+{
+	gc->cw = (l->width + CACHE_CHUNK - 1) / CACHE_CHUNK;
+	gc->ch = (l->height + CACHE_CHUNK - 1) / CACHE_CHUNK;
+	gc->slot = malloc(gc->cw * gc->ch * sizeof(*gc->slot));
+	for (size_t k = 0; k < gc->cw * gc->ch; ++k)
+		gc->slot[k] = -1;
+	gc->entries = NULL;
+	gc->nentries = gc->size = 0;
+	gc->min_scale = 1;
+	gc->nrendered = gc->nevicted = 0;
+	glGenFramebuffers(1, &gc->fbo);
+}
+
+/* Chunks a view of w x h px may overlap, wherever it is */
+static size_t cache_span(const struct glcache *gc, double w, double h)
+{
+	size_t i = min(gc->cw, (size_t)ceil(w / CHUNK_PX) + 1),
+	       j = min(gc->ch, (size_t)ceil(h / CHUNK_PX) + 1);
+	return i * j;
+}
+/* Makes room for every chunk of a scene of w x h px zoomed out down to
+ * scale, as far as CACHE_BUDGET allows, and finds how far out the views of
+ * the scene fit */
+void glcache_fit(struct glcache *gc, double w, double h, double scale)
+{
+	size_t size = min(CACHE_BUDGET, cache_span(gc, w / scale, h / scale));
+	if (size > gc->size) {
+		gc->entries = realloc(gc->entries,
+				size * sizeof(*gc->entries));
+		memset(gc->entries + gc->size, 0,
+				(size - gc->size) * sizeof(*gc->entries));
+		gc->size = size;
+	}
+	gc->min_scale = scale;
+	if (cache_span(gc, w / scale, h / scale) <= gc->size)
+		return;
+	/* the views only widen as the scale goes down */
+	double lo = scale, hi = 1;
+	for (int k = 0; k < 20; ++k) {
+		double mid = (lo + hi) / 2;
+		if (cache_span(gc, w / mid, h / mid) > gc->size)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	gc->min_scale = hi;
+}
+
+/* An entry for a chunk: a new one while the budget allows, otherwise the
+ * least recently used one not needed in this frame */
+static int cache_get(struct glcache *gc, unsigned int frame)
+{
+	if (gc->nentries < gc->size) {
+		gc->entries[gc->nentries].chunk = -1;
+		return gc->nentries++;
+	}
+	int lru = -1;
+	for (size_t k = 0; k < gc->nentries; ++k)
+		if (gc->entries[k].last_used != frame && (lru < 0 ||
+		    gc->entries[k].last_used < gc->entries[lru].last_used))
+			lru = k;
+	if (lru >= 0 && gc->entries[lru].chunk >= 0) {
+		gc->slot[gc->entries[lru].chunk] = -1;
+		++gc->nevicted;
+	}
+	return lru;
+}
+
+/* Adds a pass with the quads of the chunks visible in view, assigning
+ * entries to the missing ones, which glcache_render has to draw before the
+ * pass is submitted. The quads are premultiplied. Returns -1, having added
+ * nothing, if more chunks are visible than can be cached. */
+int glcache_draw(struct glcache *gc, const struct drect *view,
+		unsigned int frame, struct drawlist *dl)
+{
+	int ci0 = max(0, (int)floor(view->x / CHUNK_PX)),
+	    cj0 = max(0, (int)floor(view->y / CHUNK_PX)),
+	    ci1 = min((int)gc->cw - 1, (int)floor((view->x + view->w) / CHUNK_PX)),
+	    cj1 = min((int)gc->ch - 1, (int)floor((view->y + view->h) / CHUNK_PX));
+	gc->nevicted = 0;
+	if (ci1 < ci0 || cj1 < cj0)
+		return 0;
+	if ((size_t)(ci1 - ci0 + 1) * (cj1 - cj0 + 1) > gc->size)
+		return -1;
+	dl_pass(dl, PassCache, view);
+	for (int cj = cj0; cj <= cj1; ++cj)
+		for (int ci = ci0; ci <= ci1; ++ci) {
+			long chunk = cj * gc->cw + ci;
+			int s = gc->slot[chunk];
+			if (s < 0) {
+				s = cache_get(gc, frame);
+				gc->entries[s].chunk = chunk;
+				gc->entries[s].stale = 1;
+				gc->slot[chunk] = s;
+			}
+			gc->entries[s].last_used = frame;
+			dl_sprite(dl, &gc->entries[s].tm, ci * CHUNK_PX,
+					cj * CHUNK_PX, CHUNK_PX, CHUNK_PX, 0,
+					0, 0, CHUNK_PX, CHUNK_PX, 1);
+		}
+	return 0;
+}
+
+static void cache_render_chunk(struct glcache *gc, struct cache_entry *e,
+		cache_render render)
+{
+	GLint prev, vp[4];
+	GLfloat clear[4];
+	struct drect r = {
+		e->chunk % gc->cw * CHUNK_PX,
+		e->chunk / gc->cw * CHUNK_PX,
+		CHUNK_PX, CHUNK_PX
+	};
+	if (!e->tm.texno) {
+		glGenTextures(1, &e->tm.texno);
+		gl_bind_texture(&e->tm);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, CHUNK_PX, CHUNK_PX, 0,
+				GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+				GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER,
+				GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,
+				GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,
+				GL_CLAMP_TO_EDGE);
+		e->tm.w = e->tm.h = CHUNK_PX;
+	}
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prev);
+	glGetIntegerv(GL_VIEWPORT, vp);
+	glGetFloatv(GL_COLOR_CLEAR_VALUE, clear);
+	glBindFramebuffer(GL_FRAMEBUFFER, gc->fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			GL_TEXTURE_2D, e->tm.texno, 0);
+	glViewport(0, 0, CHUNK_PX, CHUNK_PX);
+	glClearColor(0, 0, 0, 0);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA,
+			GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+	render(&r);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glClearColor(clear[0], clear[1], clear[2], clear[3]);
+	glBindFramebuffer(GL_FRAMEBUFFER, prev);
+	glViewport(vp[0], vp[1], vp[2], vp[3]);
+	e->stale = 0;
+	++gc->nrendered;
+}
+/* Renders the chunks assigned by glcache_draw */
+void glcache_render(struct glcache *gc, cache_render render)
+{
+	gc->nrendered = 0;
+	for (size_t k = 0; k < gc->nentries; ++k)
+		if (gc->entries[k].stale)
+			cache_render_chunk(gc, &gc->entries[k], render);
+}
+
+void glcache_free(struct glcache *gc)
+{
+	for (size_t k = 0; k < gc->nentries; ++k)
+		if (gc->entries[k].tm.texno)
+			glDeleteTextures(1, &gc->entries[k].tm.texno);
+	if (gc->fbo)
+		glDeleteFramebuffers(1, &gc->fbo);
+	free(gc->entries);
+	free(gc->slot);
+	gc->entries = NULL;
+	gc->slot = NULL;
+	gc->nentries = gc->size = 0;
+	gc->fbo = 0;
+}
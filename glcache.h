@@ -0,0 +1,73 @@
+/* glcache.h - static scenery pre-rendered into textures of chunks
+ * Copyright (C) 2010 Michal Trybus.
+ *
+ * This file is part of FreeCG.
+ *
+ * FreeCG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeCG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeCG. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GLCACHE_H
+#define GLCACHE_H
+
+#include "cgl.h"
+#include "texmgr.h"
+#include "drawlist.h"
+#include <SDL2/SDL_opengl.h>
+
+/*
+ * Static tiles never change, so the part of the level covered by a chunk of
+ * n x n blocks is rendered once into a texture when the chunk first becomes
+ * visible, and then drawn as a single quad. The textures are recycled in
+ * LRU order. Colours are stored premultiplied by alpha.
+ */
+enum glcache_config {
+	/* side of a chunk, in blocks */
+	CACHE_CHUNK = 16,
+	/* most chunk textures, 1 MB each */
+	CACHE_BUDGET = 128
+};
+struct cache_entry {
+	/* texture of the chunk */
+	struct texmgr tm;
+	/* the chunk held, or -1 */
+	long chunk;
+	/* assigned to the chunk, but not rendered yet */
+	int stale;
+	unsigned int last_used;
+};
+struct glcache {
+	size_t cw, ch;
+	/* for each chunk, the entry holding it or -1 */
+	int *slot;
+	struct cache_entry *entries;
+	/* entries in use, and allocated */
+	size_t nentries, size;
+	/* the smallest scale whose views fit in the entries */
+	double min_scale;
+	GLuint fbo;
+	/* statistics of the last frame */
+	size_t nrendered, nevicted;
+};
+/* Draws the static tiles in the rectangle upside down, so that the top of
+ * the rectangle becomes row 0 of the texture */
+typedef void (*cache_render)(const struct drect*);
+
+void glcache_init(struct glcache*, const struct cgl*);
+void glcache_fit(struct glcache*, double, double, double);
+int glcache_draw(struct glcache*, const struct drect*, unsigned int,
+		struct drawlist*);
+void glcache_render(struct glcache*, cache_render);
+void glcache_free(struct glcache*);
+
+#endif
@@ -0,0 +1,151 @@
+/* gllod.c - reduced images of the static scenery for wide views
+ * Copyright (C) 2010 Michal Trybus.
+ *
+ * This file is part of FreeCG.
+ *
+ * FreeCG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeCG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeCG. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gllod.h"
+#include "graphics.h"
+#include "mathgeom.h"
+#include <math.h>
+
+#define SCRATCH_PX (LOD_TEX << LOD_SUPER_SHIFT)
+
+static void lod_params(void)
+{
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+/* Renders the regions one by one into a scratch texture, whose mipmap level
+ * of LOD_TEX texels is copied into the image of the region. As in glcache,
+ * colours are premultiplied, so that averaging them is right. */
+void gllod_init(struct gllod *lod, const struct cgl *l, cache_render render)
+{
+	GLint prev, vp[4];
+	GLfloat clear[4];
+	GLuint fbo[2], scratch;
+	double w = l->width * BLOCK_SIZE,
+	       h = l->height * BLOCK_SIZE;
+	int shift = LOD_SHIFT;
+	while (ldexp(w, -shift) * ldexp(h, -shift) > LOD_BUDGET)
+		++shift;
+	lod->scale = ldexp(1, -shift);
+	lod->side = LOD_TEX << shift;
+	lod->rw = ceil(w / lod->side);
+	lod->rh = ceil(h / lod->side);
+	lod->regions = calloc(lod->rw * lod->rh, sizeof(*lod->regions));
+	/* regions without static tiles are left without an image */
+	char *used = calloc(lod->rw * lod->rh, 1);
+	for (size_t k = 0; k < l->nstatic; ++k) {
+		const struct tile *t = &l->tiles[k];
+		size_t i1 = min(lod->rw - 1, (size_t)((t->x + t->w) / lod->side)),
+		       j1 = min(lod->rh - 1, (size_t)((t->y + t->h) / lod->side));
+		for (size_t j = t->y / lod->side; j <= j1; ++j)
+			for (size_t i = t->x / lod->side; i <= i1; ++i)
+				used[j * lod->rw + i] = 1;
+	}
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prev);
+	glGetIntegerv(GL_VIEWPORT, vp);
+	glGetFloatv(GL_COLOR_CLEAR_VALUE, clear);
+	glGenTextures(1, &scratch);
+	glBindTexture(GL_TEXTURE_2D, scratch);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, SCRATCH_PX, SCRATCH_PX, 0,
+			GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	lod_params();
+	/* one to render into, one to read the reduced level from */
+	glGenFramebuffers(2, fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo[1]);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			GL_TEXTURE_2D, scratch, LOD_SUPER_SHIFT);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo[0]);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			GL_TEXTURE_2D, scratch, 0);
+	glClearColor(0, 0, 0, 0);
+	for (size_t j = 0; j < lod->rh; ++j)
+		for (size_t i = 0; i < lod->rw; ++i) {
+			struct texmgr *tm = &lod->regions[j * lod->rw + i];
+			if (!used[j * lod->rw + i])
+				continue;
+			struct drect r = {
+				i * lod->side, j * lod->side,
+				lod->side, lod->side
+			};
+			glBindFramebuffer(GL_FRAMEBUFFER, fbo[0]);
+			glViewport(0, 0, SCRATCH_PX, SCRATCH_PX);
+			glClear(GL_COLOR_BUFFER_BIT);
+			glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA,
+					GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+			/* the images were bound behind gl_bind_texture, which
+			 * render has to bind the tiles with again */
+			gl.curtex = 0;
+			render(&r);
+			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+			glBindTexture(GL_TEXTURE_2D, scratch);
+			glGenerateMipmap(GL_TEXTURE_2D);
+			glGenTextures(1, &tm->texno);
+			glBindTexture(GL_TEXTURE_2D, tm->texno);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, LOD_TEX, LOD_TEX,
+					0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo[1]);
+			glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0,
+					LOD_TEX, LOD_TEX);
+			glGenerateMipmap(GL_TEXTURE_2D);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+					GL_LINEAR_MIPMAP_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER,
+					GL_LINEAR);
+			lod_params();
+			tm->w = tm->h = LOD_TEX;
+		}
+	/* the texture bindings were changed behind gl_bind_texture */
+	glBindTexture(GL_TEXTURE_2D, 0);
+	gl.curtex = 0;
+	free(used);
+	glDeleteFramebuffers(2, fbo);
+	glDeleteTextures(1, &scratch);
+	glClearColor(clear[0], clear[1], clear[2], clear[3]);
+	glBindFramebuffer(GL_FRAMEBUFFER, prev);
+	glViewport(vp[0], vp[1], vp[2], vp[3]);
+}
+
+/* Adds a pass with the images of the regions in view, premultiplied as the
+ * chunks of glcache */
+void gllod_draw(struct gllod *lod, const struct drect *view,
+		struct drawlist *dl)
+{
+	int i0 = max(0, (int)floor(view->x / lod->side)),
+	    j0 = max(0, (int)floor(view->y / lod->side)),
+	    i1 = min((int)lod->rw - 1, (int)floor((view->x + view->w) / lod->side)),
+	    j1 = min((int)lod->rh - 1, (int)floor((view->y + view->h) / lod->side));
+	dl_pass(dl, PassCache, view);
+	for (int j = j0; j <= j1; ++j)
+		for (int i = i0; i <= i1; ++i)
+			if (lod->regions[j * lod->rw + i].texno)
+				dl_sprite(dl, &lod->regions[j * lod->rw + i],
+						i * lod->side, j * lod->side,
+						lod->side, lod->side, 0,
+						0, 0, LOD_TEX, LOD_TEX, 1);
+}
+
+void gllod_free(struct gllod *lod)
+{
+	for (size_t k = 0; k < lod->rw * lod->rh; ++k)
+		if (lod->regions[k].texno)
+			glDeleteTextures(1, &lod->regions[k].texno);
+	free(lod->regions);
+	lod->regions = NULL;
+	lod->rw = lod->rh = 0;
+}
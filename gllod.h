@@ -0,0 +1,62 @@
+/* gllod.h - reduced images of the static scenery for wide views
+ * Copyright (C) 2010 Michal Trybus.
+ *
+ * This file is part of FreeCG.
+ *
+ * FreeCG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeCG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeCG. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GLLOD_H
+#define GLLOD_H
+
+#include "cgl.h"
+#include "texmgr.h"
+#include "drawlist.h"
+#include "glcache.h"
+#include <SDL2/SDL_opengl.h>
+
+/*
+ * Zoomed far out, a screen pixel covers many level pixels and the view holds
+ * too many tiles to draw one by one. Instead the level is divided into
+ * regions whose static tiles are rendered once, at load time, into
+ * mipmapped images reduced 2^shift times. Drawing them costs a few quads
+ * and about one texel per pixel, however much of the level is in view.
+ */
+enum gllod_config {
+	/* side of the image of a region, in texels */
+	LOD_TEX = 256,
+	/* images are reduced at least this many times (as a power of two) */
+	LOD_SHIFT = 2,
+	/* regions are rendered 2^LOD_SUPER_SHIFT times larger than their
+	 * images and averaged down */
+	LOD_SUPER_SHIFT = 2,
+	/* the images take at most this many texels; larger levels are
+	 * reduced more */
+	LOD_BUDGET = 16 << 20
+};
+struct gllod {
+	/* the zoom (gl.cam.scale) at which an image texel is a pixel */
+	double scale;
+	/* side of a region, in px */
+	double side;
+	size_t rw, rh;
+	/* images of the regions, row by row */
+	struct texmgr *regions;
+};
+
+void gllod_init(struct gllod*, const struct cgl*, cache_render);
+void gllod_draw(struct gllod*, const struct drect*, struct drawlist*);
+void gllod_free(struct gllod*);
+
+#endif
@@ -0,0 +1,303 @@
+/* glvbo.c - vertex buffers holding gamefield geometry
+ * Copyright (C) 2010 Michal Trybus.
+ *
+ * This file is part of FreeCG.
+ *
+ * FreeCG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeCG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeCG. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "glvbo.h"
+#include "mathgeom.h"
+#include <limits.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+
+/* the 4 vertices of a tile, in the order of gl_draw_sprite */
+static void vbo_quad(void *rec, const struct tile *t, const void *data)
+{
+	const struct texmgr *tm = data;
+	struct vbo_vertex *v = rec;
+	GLfloat u0 = (tm->x + t->tex_x) / tm->w,
+		v0 = (tm->y + t->tex_y) / tm->h,
+		u1 = (tm->x + t->tex_x + t->w) / tm->w,
+		v1 = (tm->y + t->tex_y + t->h) / tm->h;
+	v[0] = (struct vbo_vertex){u0, v0, t->x, t->y};
+	v[1] = (struct vbo_vertex){u0, v1, t->x, t->y + t->h};
+	v[2] = (struct vbo_vertex){u1, v1, t->x + t->w, t->y + t->h};
+	v[3] = (struct vbo_vertex){u1, v0, t->x + t->w, t->y};
+}
+
+/* Uploads the static tiles, grouped by the chunk of their origin, as n
+ * records of the given size each, and marks them buffered so that
+ * gl_draw_block skips them. Everything is stored backwards, last chunk and
+ * last tile first, so that the first of overlapping tiles is drawn last. */
+void vbo_static_build_with(struct vbo_static *vs, struct cgl *l, size_t size,
+		size_t n, vbo_emit emit, const void *data)
+{
+	vs->cw = (l->width + VBO_CHUNK - 1) / VBO_CHUNK;
+	vs->ch = (l->height + VBO_CHUNK - 1) / VBO_CHUNK;
+	vs->chunks = calloc(vs->cw * vs->ch, sizeof(*vs->chunks));
+	vs->buf = 0;
+	if (l->nstatic == 0)
+		return;
+	for (size_t k = 0; k < vs->cw * vs->ch; ++k) {
+		vs->chunks[k].x0 = vs->chunks[k].y0 = INT_MAX;
+		vs->chunks[k].x1 = vs->chunks[k].y1 = INT_MIN;
+	}
+	size_t *idx = malloc(l->nstatic * sizeof(*idx));
+	for (size_t k = 0; k < l->nstatic; ++k) {
+		const struct tile *t = &l->tiles[k];
+		idx[k] = t->y / BLOCK_SIZE / VBO_CHUNK * vs->cw +
+			t->x / BLOCK_SIZE / VBO_CHUNK;
+		struct vbo_chunk *c = &vs->chunks[idx[k]];
+		c->count += n;
+		c->x0 = min(c->x0, t->x);
+		c->y0 = min(c->y0, t->y);
+		c->x1 = max(c->x1, t->x + t->w);
+		c->y1 = max(c->y1, t->y + t->h);
+	}
+	GLint first = 0;
+	for (size_t k = vs->cw * vs->ch; k-- > 0;) {
+		vs->chunks[k].first = first;
+		first += vs->chunks[k].count;
+	}
+	uint8_t *recs = malloc(first * size);
+	GLsizei *fill = calloc(vs->cw * vs->ch, sizeof(*fill));
+	/* last in the order of the file, see cgl_read_sobs */
+	struct tile **tiles = cgl_file_order(l);
+	for (size_t k = l->nstatic; k-- > 0;) {
+		size_t i = idx[tiles[k] - l->tiles];
+		struct vbo_chunk *c = &vs->chunks[i];
+		emit(recs + (c->first + fill[i]) * size, tiles[k], data);
+		fill[i] += n;
+		tiles[k]->buffered = 1;
+	}
+	free(tiles);
+	free(fill);
+	free(idx);
+	glGenBuffers(1, &vs->buf);
+	glBindBuffer(GL_ARRAY_BUFFER, vs->buf);
+	glBufferData(GL_ARRAY_BUFFER, first * size, recs, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	free(recs);
+}
+void vbo_static_build(struct vbo_static *vs, struct cgl *l,
+		const struct texmgr *tm)
+{
+	vbo_static_build_with(vs, l, sizeof(struct vbo_vertex), 4, vbo_quad, tm);
+}
+
+/* Calls run for the chunks intersecting the view, from the last one on;
+ * neighbouring chunks in a row are contiguous in the buffer and passed as a
+ * single range */
+void vbo_static_visible(const struct vbo_static *vs, const struct drect *view,
+		vbo_run run, void *data)
+{
+	double side = VBO_CHUNK * BLOCK_SIZE;
+	/* tiles stick out of their chunk to the right and down only */
+	int cx0 = max(0, (int)floor(view->x / side) - 1),
+	    cy0 = max(0, (int)floor(view->y / side) - 1),
+	    cx1 = min(vs->cw - 1, (int)floor((view->x + view->w) / side)),
+	    cy1 = min(vs->ch - 1, (int)floor((view->y + view->h) / side));
+	for (int cj = cy1; cj >= cy0; --cj) {
+		GLint first = 0;
+		GLsizei count = 0;
+		for (int ci = cx1; ci >= cx0; --ci) {
+			const struct vbo_chunk *c = &vs->chunks[cj * vs->cw + ci];
+			if (c->count == 0 || c->x1 <= view->x ||
+			    c->y1 <= view->y || c->x0 >= view->x + view->w ||
+			    c->y0 >= view->y + view->h)
+				continue;
+			if (count && first + count == c->first) {
+				count += c->count;
+				continue;
+			}
+			if (count)
+				run(first, count, data);
+			first = c->first;
+			count = c->count;
+		}
+		if (count)
+			run(first, count, data);
+	}
+}
+
+/* data counts the calls */
+static void vbo_draw_quads(GLint first, GLsizei count, void *data)
+{
+	glDrawArrays(GL_QUADS, first, count);
+	++*(int*)data;
+}
+/* The texture must be bound already; returns the number of draw calls */
+int vbo_static_draw(const struct vbo_static *vs, const struct drect *view)
+{
+	int calls = 0;
+	if (!vs->buf)
+		return 0;
+	glBindBuffer(GL_ARRAY_BUFFER, vs->buf);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glTexCoordPointer(2, GL_FLOAT, sizeof(struct vbo_vertex),
+			(const GLvoid*)offsetof(struct vbo_vertex, u));
+	glVertexPointer(2, GL_FLOAT, sizeof(struct vbo_vertex),
+			(const GLvoid*)offsetof(struct vbo_vertex, x));
+	vbo_static_visible(vs, view, vbo_draw_quads, &calls);
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	return calls;
+}
+
+void vbo_static_free(struct vbo_static *vs)
+{
+	if (vs->buf)
+		glDeleteBuffers(1, &vs->buf);
+	free(vs->chunks);
+	vs->chunks = NULL;
+	vs->buf = 0;
+}
+
+/* Hidden and unlit tiles are written as empty quads */
+static void vbo_dyn_quad(void *rec, const struct tile *t, const void *data)
+{
+	const struct vbo_quad_data *d = data;
+	if (t->type == Transparent || (t->type == Blink && !d->blink_on))
+		memset(rec, 0, 4 * sizeof(struct vbo_vertex));
+	else
+		vbo_quad(rec, t, d->tm);
+}
+
+/* tiles are the ones drawn, see interp.h */
+void vbo_dynamic_build_with(struct vbo_dynamic *vd, struct tile *tiles,
+		size_t ntiles, size_t size, size_t n, vbo_emit emit,
+		const void *data)
+{
+	vd->tiles = tiles;
+	vd->ntiles = ntiles;
+	vd->rec_size = size;
+	vd->nrec = n;
+	vd->emit = emit;
+	vd->recs = calloc(vd->ntiles * n, size);
+	vd->slot = malloc((vd->ntiles + 1) * sizeof(*vd->slot));
+	vd->blink_on = 0;
+	vd->buf = 0;
+	if (vd->ntiles == 0)
+		return;
+	/* layer by layer, each one backwards as the static tiles */
+	size_t next[LayerOSD + 1] = {0};
+	for (size_t k = 0; k < vd->ntiles; ++k)
+		++next[vd->tiles[k].layer];
+	for (size_t i = 0, first = 0; i <= LayerOSD; ++i) {
+		size_t count = next[i];
+		next[i] = first;
+		first += count;
+	}
+	for (size_t k = vd->ntiles; k-- > 0;)
+		vd->slot[k] = next[vd->tiles[k].layer]++;
+	for (size_t k = 0; k < vd->ntiles; ++k) {
+		emit(vd->recs + vd->slot[k] * n * size, &vd->tiles[k], data);
+		vd->tiles[k].buffered = 1;
+		vd->tiles[k].dirty = 0;
+	}
+	glGenBuffers(1, &vd->buf);
+	glBindBuffer(GL_ARRAY_BUFFER, vd->buf);
+	glBufferData(GL_ARRAY_BUFFER, vd->ntiles * n * size, vd->recs,
+			GL_STREAM_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+void vbo_dynamic_build(struct vbo_dynamic *vd, struct tile *tiles,
+		size_t ntiles, const struct texmgr *tm)
+{
+	struct vbo_quad_data d = {tm, 0};
+	vbo_dynamic_build_with(vd, tiles, ntiles, sizeof(struct vbo_vertex), 4,
+			vbo_dyn_quad, &d);
+}
+
+/* Called once per frame; blinking tiles are rewritten too if blink is set */
+void vbo_dynamic_update_with(struct vbo_dynamic *vd, const void *data,
+		int blink)
+{
+	size_t lo = vd->ntiles,
+	       hi = 0,
+	       rec = vd->nrec * vd->rec_size;
+	vd->nrewritten = vd->nbytes = 0;
+	if (!vd->buf)
+		return;
+	for (size_t k = 0; k < vd->ntiles; ++k) {
+		struct tile *t = &vd->tiles[k];
+		if (!t->dirty && !(blink && t->type == Blink))
+			continue;
+		vd->emit(vd->recs + vd->slot[k] * rec, t, data);
+		t->dirty = 0;
+		lo = min(lo, vd->slot[k]);
+		hi = max(hi, vd->slot[k] + 1);
+		++vd->nrewritten;
+	}
+	if (lo >= hi)
+		return;
+	glBindBuffer(GL_ARRAY_BUFFER, vd->buf);
+	if (2 * (hi - lo) > vd->ntiles) {
+		/* most of it changed: orphan the buffer instead of waiting for
+		 * the previous frame to be done with it */
+		lo = 0, hi = vd->ntiles;
+		glBufferData(GL_ARRAY_BUFFER, vd->ntiles * rec, NULL,
+				GL_STREAM_DRAW);
+	}
+	vd->nbytes = (hi - lo) * rec;
+	glBufferSubData(GL_ARRAY_BUFFER, lo * rec, vd->nbytes,
+			vd->recs + lo * rec);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+/* blink_on tells whether blinking tiles are lit */
+void vbo_dynamic_update(struct vbo_dynamic *vd, const struct texmgr *tm,
+		int blink_on)
+{
+	struct vbo_quad_data d = {tm, blink_on};
+	int changed = blink_on != vd->blink_on;
+	vd->blink_on = blink_on;
+	vbo_dynamic_update_with(vd, &d, changed);
+}
+
+/* All dynamic tiles in one call; there are few of them and the GPU culls
+ * those off the screen. The texture must be bound already. Returns the
+ * number of draw calls. */
+int vbo_dynamic_draw(const struct vbo_dynamic *vd)
+{
+	if (!vd->buf)
+		return 0;
+	glBindBuffer(GL_ARRAY_BUFFER, vd->buf);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glTexCoordPointer(2, GL_FLOAT, sizeof(struct vbo_vertex),
+			(const GLvoid*)offsetof(struct vbo_vertex, u));
+	glVertexPointer(2, GL_FLOAT, sizeof(struct vbo_vertex),
+			(const GLvoid*)offsetof(struct vbo_vertex, x));
+	glDrawArrays(GL_QUADS, 0, 4 * vd->ntiles);
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	return 1;
+}
+
+void vbo_dynamic_free(struct vbo_dynamic *vd)
+{
+	if (vd->buf)
+		glDeleteBuffers(1, &vd->buf);
+	free(vd->recs);
+	free(vd->slot);
+	vd->recs = NULL;
+	vd->slot = NULL;
+	vd->buf = 0;
+}
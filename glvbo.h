@@ -0,0 +1,98 @@
+/* glvbo.h - vertex buffers holding gamefield geometry
+ * Copyright (C) 2010 Michal Trybus.
+ *
+ * This file is part of FreeCG.
+ *
+ * FreeCG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeCG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeCG. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GLVBO_H
+#define GLVBO_H
+
+#include "cgl.h"
+#include "texmgr.h"
+#include <SDL2/SDL_opengl.h>
+
+enum glvbo_config {
+	/* side of a chunk of static tiles, in blocks */
+	VBO_CHUNK = 32
+};
+/* Writes the records (vertices or instances) of a tile; data is passed
+ * through from the caller */
+typedef void (*vbo_emit)(void*, const struct tile*, const void*);
+/* Called for every range of records to draw */
+typedef void (*vbo_run)(GLint, GLsizei, void*);
+
+/* one vertex of a textured quad, as uploaded */
+struct vbo_vertex {
+	GLfloat u, v;
+	GLfloat x, y;
+};
+/* Static tiles anchored in a chunk: their range in the buffer and the
+ * bounding box (in px), which may exceed the chunk */
+struct vbo_chunk {
+	GLint first;
+	GLsizei count;
+	int x0, y0, x1, y1;
+};
+/* All static (SOBS) tiles of a level, uploaded once and drawn chunk by
+ * chunk. Tiles of streamed levels are not included. */
+struct vbo_static {
+	GLuint buf;
+	size_t cw, ch;
+	struct vbo_chunk *chunks;
+};
+
+/* what the fixed-function emitters need */
+struct vbo_quad_data {
+	const struct texmgr *tm;
+	/* whether blinking tiles are lit */
+	int blink_on;
+};
+/* Dynamic tiles (the renderer's copies of tiles[nstatic..ntiles)), nrec
+ * records each. Tiles marked dirty are rewritten in a CPU copy and the span
+ * between the first and the last of them is uploaded once per frame. The
+ * records of tile k are at slot[k], so that they are drawn layer by
+ * layer. */
+struct vbo_dynamic {
+	GLuint buf;
+	struct tile *tiles;
+	size_t ntiles;
+	size_t *slot;
+	size_t rec_size, nrec;
+	vbo_emit emit;
+	uint8_t *recs;
+	/* state of blinking tiles when last uploaded by vbo_dynamic_update */
+	int blink_on;
+	/* statistics: tiles and bytes uploaded during the last update */
+	size_t nrewritten, nbytes;
+};
+
+void vbo_static_build_with(struct vbo_static*, struct cgl*, size_t, size_t,
+		vbo_emit, const void*);
+void vbo_static_visible(const struct vbo_static*, const struct drect*,
+		vbo_run, void*);
+void vbo_static_build(struct vbo_static*, struct cgl*, const struct texmgr*);
+int vbo_static_draw(const struct vbo_static*, const struct drect*);
+void vbo_static_free(struct vbo_static*);
+void vbo_dynamic_build_with(struct vbo_dynamic*, struct tile*, size_t,
+		size_t, size_t, vbo_emit, const void*);
+void vbo_dynamic_update_with(struct vbo_dynamic*, const void*, int);
+void vbo_dynamic_build(struct vbo_dynamic*, struct tile*, size_t,
+		const struct texmgr*);
+void vbo_dynamic_update(struct vbo_dynamic*, const struct texmgr*, int);
+int vbo_dynamic_draw(const struct vbo_dynamic*);
+void vbo_dynamic_free(struct vbo_dynamic*);
+
+#endif
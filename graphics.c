@@ -21,6 +21,11 @@
 #include "osd.h"
 #include "mathgeom.h"
 #include "texmgr.h"
+#include "gl33.h"
+#include "glcache.h"
+#include "gllod.h"
+#include "interp.h"
+#include "prof.h"
 #include <assert.h>
 #include <math.h>
 
@@ -28,13 +33,23 @@
 
 struct glengine gl;
 void gl_draw_sprite(double, double, const struct tile*);
+static void gl_render_static(const struct drect*);
 
 // Ajout d'une variable globale pour stocker la fenêtre SDL
 SDL_Window *gl_window = NULL;
 
+/* Makes the cache hold every chunk of the widest view it draws: down to the
+ * scale of the LOD images, if there are some */
+static void gl_fit_cache(void)
+{
+	if (gl.cache.slot)
+		glcache_fit(&gl.cache, gl.scene_w, gl.scene_h,
+				gl.lod.regions ? gl.lod.scale : MIN_SCALE);
+}
 void gl_init(struct cgl* l, struct texmgr *ttm, struct texmgr *ftm,
 		struct texmgr *otm)
 {
+	Uint64 t = trace_begin();
 	gl.ttm = ttm;
 	gl.ftm = ftm;
 	gl.otm = otm;
@@ -43,13 +58,37 @@ void gl_init(struct cgl* l, struct texmgr *ttm, struct texmgr *ftm,
 	gl.cam.scale = 1;
 	gl.cam.x = l->width  * BLOCK_SIZE / 2;
 	gl.cam.y = l->height * BLOCK_SIZE / 2;
-	glEnable(GL_TEXTURE_2D);
-	glEnable(GL_DEPTH_TEST);
+	interp_init(&gl.interp, l);
+	if (gl.soft) {
+		/* every tile is traversed into sprites */
+		osd_init();
+		SDL_ShowCursor(SDL_DISABLE);
+		trace_end("gl_init", t);
+		return;
+	}
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 	glClearColor(0.1, 0.1, 0.1, 1);
+	if (gl.gl33) {
+		if (gl33_init(l, gl.interp.tiles, ttm) < 0) {
+			fprintf(stderr, "gl33_init: %s\n", SDL_GetError());
+			abort();
+		}
+	} else {
+		glEnable(GL_TEXTURE_2D);
+		vbo_static_build(&gl.statics, l, ttm);
+		vbo_dynamic_build(&gl.dynamics, gl.interp.tiles,
+				gl.interp.ntiles, ttm);
+	}
+	if (l->nstatic && !gl.nocache)
+		glcache_init(&gl.cache, l);
+	/* streamed tiles are not all there to be rendered */
+	if (l->nstatic && !gl.nocache && !l->stream)
+		gllod_init(&gl.lod, l, gl_render_static);
+	gl_fit_cache();
 	osd_init();
 	SDL_ShowCursor(SDL_DISABLE);
+	trace_end("gl_init", t);
 }
 
 // Mise à jour pour stocker la référence à la fenêtre
@@ -58,28 +97,65 @@ void gl_set_window(SDL_Window *window)
     gl_window = window;
 }
 
+/* Allocates the offscreen target of the scene, or frees it if the scene is
+ * drawn directly */
+static void gl_resize_target(void)
+{
+	GLint prev;
+	if (gl.px == 1) {
+		if (gl.fbo) {
+			glDeleteFramebuffers(1, &gl.fbo);
+			glDeleteRenderbuffers(1, &gl.fbo_color);
+			gl.fbo = 0;
+		}
+		return;
+	}
+	if (!gl.fbo) {
+		glGenFramebuffers(1, &gl.fbo);
+		glGenRenderbuffers(1, &gl.fbo_color);
+	}
+	glBindRenderbuffer(GL_RENDERBUFFER, gl.fbo_color);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, gl.scene_w, gl.scene_h);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prev);
+	glBindFramebuffer(GL_FRAMEBUFFER, gl.fbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			GL_RENDERBUFFER, gl.fbo_color);
+	glBindFramebuffer(GL_FRAMEBUFFER, prev);
+}
 void gl_resize_viewport(double w, double h)
 {
 	gl.win_w = w, gl.win_h = h;
+	/* the largest whole factor leaving at least NATIVE_W x NATIVE_H */
+	gl.px = gl.soft ? 1 : max(1, min((int)w / NATIVE_W, (int)h / NATIVE_H));
+	gl.scene_w = ceil(w / gl.px);
+	gl.scene_h = ceil(h / gl.px);
+	if (gl.soft) {
+		soft_resize(&gl.fb, w, h);
+		return;
+	}
+	gl_resize_target();
+	gl_fit_cache();
+	if (gl.gl33)
+		return;
 	glMatrixMode(GL_PROJECTION);
 	glLoadIdentity();
 	glScalef(1, -1, 1);
-	glOrtho(0, w, 0, h, -5, 5);
+	glOrtho(0, w, 0, h, -1, 1);
 	glMatrixMode(GL_MODELVIEW);
 }
 void gl_look_at(double x, double y, double scale)
 {
-	gl.viewport.w = gl.win_w/scale;
-	gl.viewport.h = gl.win_h/scale;
+	gl.viewport.w = gl.scene_w/scale;
+	gl.viewport.h = gl.scene_h/scale;
 	gl.viewport.x = fmin(gl.l->width*BLOCK_SIZE - gl.viewport.w,
 			fmax(0, x - gl.viewport.w/2));
 	gl.viewport.y = fmin(gl.l->height*BLOCK_SIZE - gl.viewport.h,
 			fmax(0, y - gl.viewport.h/2));
-	glScalef(scale, scale, 1);
-	glTranslated(-gl.viewport.x, -gl.viewport.y, 0);
 }
 
-void gl_draw_scene()
+/* Traverses the gamefield into dl, without calling GL */
+void gl_build_scene(struct drawlist *dl)
 {
 	extern void fix_lframes(struct cgl*),
 	            gl_draw_block(struct tile *[]),
@@ -87,51 +163,88 @@ void gl_draw_scene()
 	gl_look_at(gl.cam.x, gl.cam.y, gl.cam.scale);
 	if (gl.frame == 0)
 		fix_lframes(gl.l);
+	dl->time = interp_time(&gl.interp, gl.state);
+	/* below the scale of the images, and wherever the views are too wide
+	 * for the cache */
+	if (gl.lod.regions &&
+	    gl.cam.scale <= fmax(gl.lod.scale, gl.cache.min_scale)) {
+		/* every tile is in the vertex buffers, so nothing is left to
+		 * traverse */
+		gllod_draw(&gl.lod, &gl.viewport, dl);
+		dl_pass(dl, PassDynamic, &gl.viewport);
+		dl_pass(dl, PassSprites, &gl.viewport);
+		gl_draw_ship();
+		gl.frame++;
+		return;
+	}
+	int cached = gl.cache.slot &&
+		glcache_draw(&gl.cache, &gl.viewport, gl.frame, dl) == 0;
+	if (!cached)
+		dl_pass(dl, PassStatic, &gl.viewport);
+	if (!gl.soft && !gl.l->stream) {
+		/* every tile is in the vertex buffers */
+		dl_pass(dl, PassDynamic, &gl.viewport);
+		dl_pass(dl, PassSprites, &gl.viewport);
+		gl_draw_ship();
+		gl.frame++;
+		return;
+	}
 	double x1 = fmax(0, gl.viewport.x),
 	       y1 = fmax(0, gl.viewport.y),
 	       x2 = fmin(gl.viewport.x + gl.viewport.w,
 			       gl.l->width * BLOCK_SIZE),
 	       y2 = fmin(gl.viewport.y + gl.viewport.h,
 			       gl.l->height * BLOCK_SIZE);
-	glColor4f(1, 1, 1, 1);
-	gl_bind_texture(gl.ttm);
+	/* tiles not in the vertex buffers: of all layers in soft mode, of
+	 * streamed levels otherwise */
+	dl_pass(dl, PassSprites, &gl.viewport);
+	size_t bx1 = x1 / BLOCK_SIZE,
+	       by1 = y1 / BLOCK_SIZE,
+	       bx2 = x2 > x1 ? ceil(x2 / BLOCK_SIZE) : bx1,
+	       by2 = y2 > y1 ? ceil(y2 / BLOCK_SIZE) : by1;
+	/* empty super-cells are skipped as a whole */
+	for (size_t sj = by1 >> GRID_SHIFT; sj << GRID_SHIFT < by2; ++sj)
+		for (size_t si = bx1 >> GRID_SHIFT; si << GRID_SHIFT < bx2; ++si) {
+			const struct cgl_super *s = cgl_super(gl.l, si, sj);
+			if (!s)
+				continue;
+			size_t i1 = max(bx1, si << GRID_SHIFT),
+			       j1 = max(by1, sj << GRID_SHIFT),
+			       i2 = min(bx2, (si + 1) << GRID_SHIFT),
+			       j2 = min(by2, (sj + 1) << GRID_SHIFT);
+			for (size_t j = j1; j < j2; ++j)
+				for (size_t i = i1; i < i2; ++i)
+					gl_draw_block(s->cells[cgl_cell(i, j)]);
+		}
+	dl_pass(dl, PassDynamic, &gl.viewport);
+	dl_pass(dl, PassSprites, &gl.viewport);
 	gl_draw_ship();
-	glPushMatrix();
-	glTranslated(0, 0, 0.1);
-	glBegin(GL_QUADS);
-	for (size_t j = y1/BLOCK_SIZE; j*BLOCK_SIZE < y2; ++j)
-		for (size_t i = x1/BLOCK_SIZE; i*BLOCK_SIZE < x2; ++i)
-			gl_draw_block(gl.l->blocks[j][i]);
-	glEnd();
-	glPopMatrix();
 	gl.frame++;
 }
 void fix_lframes(struct cgl *level)
 {
-	for (size_t i = 0; i < level->ntiles; ++i)
+	/* the dynamic tiles of the level are the simulation's */
+	for (size_t i = 0; i < level->nstatic; ++i)
 		level->tiles[i].lframe = 0;
+	for (size_t i = 0; i < gl.interp.ntiles; ++i)
+		gl.interp.tiles[i].lframe = 0;
 	gl.frame = 1;
 }
 void gl_draw_ship(void)
 {
 	struct tile tile;
-	ship_to_tile(gl.l->ship, &tile); /* to get tex coordinates */
-	glBegin(GL_QUADS);
-	gl_draw_sprite(gl.l->ship->x, gl.l->ship->y, &tile);
-	glEnd();
+	double x, y;
+	ship_to_tile(&gl.state->ship, &tile); /* to get tex coordinates */
+	tile.layer = LayerShip;
+	interp_ship(&gl.interp, gl.state, &x, &y);
+	gl_draw_sprite(x, y, &tile);
 }
 /* this function uses x and y as coordinates instead of tile's x and y, to
  * support subpixel rendering */
 void gl_draw_sprite(double x, double y, const struct tile *tile)
 {
-	tm_coord_tl(gl.ttm, tile->tex_x, tile->tex_y, tile->w, tile->h);
-	glVertex3d(x, y, tile->z);
-	tm_coord_bl(gl.ttm, tile->tex_x, tile->tex_y, tile->w, tile->h);
-	glVertex3d(x, y + tile->h, tile->z);
-	tm_coord_br(gl.ttm, tile->tex_x, tile->tex_y, tile->w, tile->h);
-	glVertex3d(x + tile->w, y + tile->h, tile->z);
-	tm_coord_tr(gl.ttm, tile->tex_x, tile->tex_y, tile->w, tile->h);
-	glVertex3d(x + tile->w, y, tile->z);
+	dl_sprite(&gl.dl, gl.ttm, x, y, tile->w, tile->h, tile->layer,
+			tile->tex_x, tile->tex_y, tile->w, tile->h, 1);
 }
 /* Each tile may be referenced by many blocks. This function makes sure each
  * tile is drawn to the buffer only once */
@@ -139,11 +252,17 @@ void gl_draw_block(struct tile *tiles[])
 {
 	extern void gl_dispatch_drawing(const struct tile*);
 	for (size_t i = 0; tiles[i]; ++i) {
+		struct tile *t = interp_tile(&gl.interp, gl.l, tiles[i]);
+		++gl.counting.visited;
+		/* drawn from the vertex buffers already */
+		if (t->buffered)
+			continue;
 		/* if the tile has not been drawn in current frame yet, draw
 		 * and update tile's frame number */
-		if (tiles[i]->lframe != gl.frame) {
-			gl_dispatch_drawing(tiles[i]);
-			tiles[i]->lframe = gl.frame;
+		if (t->lframe != gl.frame) {
+			gl_dispatch_drawing(t);
+			++gl.counting.drawn;
+			t->lframe = gl.frame;
 		}
 	}
 }
@@ -153,7 +272,7 @@ inline void gl_draw_simple_tile(const struct tile *tile)
 }
 inline void gl_draw_blinking_tile(const struct tile *tile)
 {
-	int phase = round(gl.l->time * BLINK_SPEED);
+	int phase = round(gl.state->time * BLINK_SPEED);
 	if (phase % 2 == 0)
 		gl_draw_sprite(tile->x, tile->y, tile);
 }
@@ -170,12 +289,170 @@ void gl_dispatch_drawing(const struct tile *tile)
 	}
 }
 
+/* ==================== Submission ==================== */
+
+/* Draws the static tiles of r into a chunk of the cache */
+static void gl_render_static(const struct drect *r)
+{
+	gl_bind_texture(gl.ttm);
+	if (gl.gl33) {
+		struct drect flip = {r->x, r->y + r->h, r->w, -r->h};
+		gl33_set_view(&flip);
+		gl33_draw_static(r, gl.state->time);
+		return;
+	}
+	glMatrixMode(GL_PROJECTION);
+	glPushMatrix();
+	glLoadIdentity();
+	glOrtho(r->x, r->x + r->w, r->y, r->y + r->h, -1, 1);
+	glMatrixMode(GL_MODELVIEW);
+	glLoadIdentity();
+	glColor4f(1, 1, 1, 1);
+	gl.counting.calls += vbo_static_draw(&gl.statics, r);
+	glMatrixMode(GL_PROJECTION);
+	glPopMatrix();
+	glMatrixMode(GL_MODELVIEW);
+}
+/* Maps view to the window */
+static void gl_set_view(const struct drect *view)
+{
+	if (gl.gl33) {
+		gl33_set_view(view);
+		return;
+	}
+	glLoadIdentity();
+	glScaled(gl.win_w / view->w, gl.win_h / view->h, 1);
+	glTranslated(-view->x, -view->y, 0);
+}
+/* Sprites in runs of the same texture */
+static void gl_submit_sprites(const struct draw_rec *r, size_t n)
+{
+	if (gl.gl33) {
+		for (size_t i = 0; i < n; ++i)
+			gl33_quad(r[i].tm, r[i].x, r[i].y, r[i].w, r[i].h,
+					r[i].tex_x, r[i].tex_y,
+					r[i].tex_w, r[i].tex_h, r[i].a);
+		gl33_flush();
+		return;
+	}
+	for (size_t i = 0; i < n;) {
+		GLuint texno = r[i].tm->texno;
+		float a = -1;
+		gl_bind_texture(r[i].tm);
+		glBegin(GL_QUADS);
+		for (; i < n && r[i].tm->texno == texno; ++i) {
+			struct texmgr *tm = r[i].tm;
+			if (r[i].a != a) {
+				a = r[i].a;
+				glColor4f(1, 1, 1, a);
+			}
+			tm_coord_tl(tm, r[i].tex_x, r[i].tex_y,
+					r[i].tex_w, r[i].tex_h);
+			glVertex2f(r[i].x, r[i].y);
+			tm_coord_bl(tm, r[i].tex_x, r[i].tex_y,
+					r[i].tex_w, r[i].tex_h);
+			glVertex2f(r[i].x, r[i].y + r[i].h);
+			tm_coord_br(tm, r[i].tex_x, r[i].tex_y,
+					r[i].tex_w, r[i].tex_h);
+			glVertex2f(r[i].x + r[i].w, r[i].y + r[i].h);
+			tm_coord_tr(tm, r[i].tex_x, r[i].tex_y,
+					r[i].tex_w, r[i].tex_h);
+			glVertex2f(r[i].x + r[i].w, r[i].y);
+		}
+		glEnd();
+		++gl.counting.calls;
+	}
+}
+/* Clears the target of the scene */
+static void gl_begin_scene(void)
+{
+	if (gl.fbo) {
+		glBindFramebuffer(GL_FRAMEBUFFER, gl.fbo);
+		glViewport(0, 0, gl.scene_w, gl.scene_h);
+	}
+	glClear(GL_COLOR_BUFFER_BIT);
+}
+/* Scales the scene up into the framebuffer of the window, with the right
+ * and bottom edges left over by the division cut off */
+static void gl_upscale(GLuint window)
+{
+	if (!gl.fbo)
+		return;
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, gl.fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, window);
+	glBlitFramebuffer(0, 0, gl.scene_w, gl.scene_h,
+			0, gl.win_h - gl.scene_h * gl.px,
+			gl.scene_w * gl.px, gl.win_h,
+			GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, window);
+	glViewport(0, 0, gl.win_w, gl.win_h);
+}
+/* Draws the passes of dl in order, the overlay over the scaled-up scene */
+void gl_submit(const struct drawlist *dl)
+{
+	GLint window;
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &window);
+	gl_begin_scene();
+	for (size_t p = 0; p < dl->npasses; ++p) {
+		const struct draw_pass *pass = &dl->passes[p];
+		if (p == dl->overlay)
+			gl_upscale(window);
+		if (pass->kind == PassCache)
+			glcache_render(&gl.cache, gl_render_static);
+		gl_set_view(&pass->view);
+		switch (pass->kind) {
+		case PassSprites:
+			gl_submit_sprites(dl->recs + pass->first, pass->count);
+			break;
+		case PassCache:
+			glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+			gl_submit_sprites(dl->recs + pass->first, pass->count);
+			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+			break;
+		case PassStatic:
+			gl_bind_texture(gl.ttm);
+			if (gl.gl33) {
+				gl33_draw_static(&pass->view, dl->time);
+				break;
+			}
+			glColor4f(1, 1, 1, 1);
+			gl.counting.calls += vbo_static_draw(&gl.statics,
+					&pass->view);
+			break;
+		case PassDynamic:
+			gl_bind_texture(gl.ttm);
+			if (gl.gl33) {
+				gl33_draw_dynamic(dl->time);
+				break;
+			}
+			glColor4f(1, 1, 1, 1);
+			vbo_dynamic_update(&gl.dynamics, gl.ttm,
+					(int)round(dl->time * BLINK_SPEED) % 2 == 0);
+			gl.counting.calls += vbo_dynamic_draw(&gl.dynamics);
+			break;
+		}
+	}
+	if (dl->overlay >= dl->npasses)
+		gl_upscale(window);
+}
+
 /* ==================== General graphics ==================== */
 
+/* A textured rectangle of the OSD with opacity a */
+void gl_draw_quad(struct texmgr *tm, double x, double y, double w, double h,
+		double z, int tex_x, int tex_y, int tex_w, int tex_h, double a)
+{
+	dl_sprite(&gl.dl, tm, x, y, w, h, z, tex_x, tex_y, tex_w, tex_h, a);
+}
+
 void gl_draw_osd(double time)
 {
+	Uint64 t = prof_begin();
 	osd_step(time);
+	prof_end(ProfOSDStep, t);
+	t = prof_begin();
 	osd_draw();
+	prof_end(ProfOSDDraw, t);
 }
 void gl_cam_step(double dt)
 {
@@ -191,13 +468,48 @@ void gl_cam_step(double dt)
 void gl_update_window(double time)
 {
 	double dt = time - gl.time;
+	Uint64 t = prof_begin();
+	if (gl.start)
+		prof_span(ProfFrame, gl.start, t);
+	gl.start = t;
+	gl.counts = gl.counting;
+	gl.counting = (struct gl_counts){0};
 	gl_cam_step(dt);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	glLoadIdentity();
-	gl_draw_scene();
-	glLoadIdentity();
-	glTranslated(0, 0, 2);
+	struct drect win = {0, 0, gl.win_w, gl.win_h};
+	dl_clear(&gl.dl);
+	interp_blend(&gl.interp, gl.state);
+	gl_build_scene(&gl.dl);
+	dl_overlay(&gl.dl);
+	dl_pass(&gl.dl, PassSprites, &win);
+	prof_end(ProfScene, t);
 	gl_draw_osd(time);
+	t = prof_begin();
+	dl_sort(&gl.dl);
+	if (gl.soft) {
+		/* glClearColor of gl_init */
+		static const Uint8 clear[4] = {26, 26, 26, 255};
+		soft_clear(&gl.fb, clear);
+		soft_submit(&gl.fb, &gl.dl);
+	} else {
+		gl_submit(&gl.dl);
+	}
+	prof_end(ProfSubmit, t);
+	t = prof_begin();
+	/* none while the window is not of the size it was opened at */
+	int capture = gl.capture && gl.win_w == gl.capture->w &&
+		gl.win_h == gl.capture->h;
+	if (gl.soft) {
+		if (gl_window && soft_present(&gl.fb, gl_window) < 0)
+			fprintf(stderr, "soft_present: %s\n", SDL_GetError());
+		if (capture)
+			capture_pixels(gl.capture, gl.fb.pixels, time);
+		prof_end(ProfSwap, t);
+		gl.time = time;
+		return;
+	}
+	/* read back before the swap leaves the back buffer undefined */
+	if (capture)
+		capture_frame(gl.capture, time);
 	
 	// Remplacer SDL_GL_SwapBuffers() par SDL_GL_SwapWindow()
 	if (gl_window) {
@@ -205,6 +517,7 @@ void gl_update_window(double time)
 	} else {
 		fprintf(stderr, "Error: Window not set for gl_update_window\n");
 	}
+	prof_end(ProfSwap, t);
 	
 	gl.time = time;
 }
\ No newline at end of file
@@ -22,6 +22,13 @@
 
 #include "cg.h"
 #include "texmgr.h"
+#include "glvbo.h"
+#include "glcache.h"
+#include "gllod.h"
+#include "drawlist.h"
+#include "soft.h"
+#include "capture.h"
+#include "interp.h"
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_opengl.h>
 
@@ -30,17 +37,52 @@ struct camera {
 	double nx, ny;
 	double scale;
 };
+/* Work done by a frame: tiles looked at by gl_draw_block and, of them,
+ * those drawn as sprites; and GL draw calls issued */
+struct gl_counts {
+	unsigned int visited, drawn, calls;
+};
 struct glengine {
 	double time;
+	/* when the last frame was started, for ProfFrame */
+	Uint64 start;
 	struct texmgr *ttm,
 		      *ftm,
 		      *otm;
 	struct drect viewport;
 	struct camera cam;
 	double win_w, win_h;
+	/* the scene is drawn at scene_w x scene_h into fbo, and scaled up px
+	 * times into the window; directly into the window if px is 1 */
+	int px;
+	double scene_w, scene_h;
+	GLuint fbo, fbo_color;
 	struct cgl *l;
 	unsigned int frame;
 	GLuint curtex;
+	struct vbo_static statics;
+	struct vbo_dynamic dynamics;
+	/* the latest frame of the simulation, set before gl_init */
+	const struct sim_frame *state;
+	/* the ship and dynamic tiles between simulation steps */
+	struct interp interp;
+	/* OpenGL 3.3 core profile renderer, see gl33.h */
+	int gl33;
+	/* static tiles drawn from pre-rendered chunks unless nocache */
+	struct glcache cache;
+	int nocache;
+	/* images of the static tiles for zooms below lod.scale, or too wide
+	 * for the cache */
+	struct gllod lod;
+	/* the frame being traversed */
+	struct drawlist dl;
+	/* no GL at all: frames are drawn into fb by soft.c */
+	int soft;
+	struct soft_fb fb;
+	/* frames recorded by capture.c, if not NULL */
+	struct capture *capture;
+	/* of the last frame drawn, and of the one being drawn */
+	struct gl_counts counts, counting;
 };
 extern struct glengine gl;
 
@@ -48,6 +90,10 @@ void gl_init(struct cgl*, struct texmgr*, struct texmgr*, struct texmgr*);
 void gl_resize_viewport(double, double);
 void gl_set_window(SDL_Window *window);
 void gl_update_window(double);
+void gl_build_scene(struct drawlist*);
+void gl_submit(const struct drawlist*);
+void gl_draw_quad(struct texmgr*, double, double, double, double, double,
+		int, int, int, int, double);
 
 static inline void gl_bind_texture(struct texmgr *tm)
 {
@@ -59,5 +105,10 @@ static inline void gl_bind_texture(struct texmgr *tm)
 
 #define BLINK_SPEED 1.8
 #define CAM_SPEED 2
+/* the widest zoom (cam.scale) */
+#define MIN_SCALE (1.0 / 64)
+/* the smallest resolution the scene is drawn at before scaling up */
+#define NATIVE_W 640
+#define NATIVE_H 480
 
 #endif
@@ -0,0 +1,99 @@
+/* interp.c - blending of the simulation state between fixed steps
+ * Copyright (C) 2010 Michal Trybus.
+ *
+ * This file is part of FreeCG.
+ *
+ * FreeCG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeCG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeCG. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "interp.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+void interp_init(struct interp *ip, const struct cgl *l)
+{
+	ip->ntiles = l->ntiles - l->nstatic;
+	ip->tiles = malloc((ip->ntiles + 1) * sizeof(*ip->tiles));
+	memcpy(ip->tiles, l->tiles + l->nstatic,
+			ip->ntiles * sizeof(*ip->tiles));
+	ip->alpha = 1;
+}
+
+/* b + (1 - alpha)(a - b), rounded away from zero, so that edges moving
+ * together, as x and w of a tile sliding left, stay together */
+static inline int blend(double s, int a, int b)
+{
+	return b + lround(s * (a - b));
+}
+/* An edge c (x or tex_x) moving against the length l, as when a tile
+ * slides, is blended with it; anything else, as the frames of animations,
+ * jumps */
+static inline int follow(double s, int pc, int c, int pl, int l)
+{
+	return pc - c == l - pl ? blend(s, pc, c) : c;
+}
+/* Brings the copies of the dynamic tiles up to the frame f, marking those
+ * that changed dirty; the frames of animations are not a change where the
+ * renderer animates them */
+void interp_blend(struct interp *ip, const struct sim_frame *f)
+{
+	double s = 1 - ip->alpha;
+	for (size_t k = 0; k < ip->ntiles; ++k) {
+		const struct tile *t = &f->tiles[k];
+		struct tile *d = &ip->tiles[k],
+			    n = *t;
+		const struct interp_geom *p = &f->prev[k];
+		n.w = blend(s, p->w, t->w);
+		n.h = blend(s, p->h, t->h);
+		n.x = follow(s, p->x, t->x, p->w, t->w);
+		n.y = follow(s, p->y, t->y, p->h, t->h);
+		n.tex_x = follow(s, p->tex_x, t->tex_x, p->w, t->w);
+		n.tex_y = follow(s, p->tex_y, t->tex_y, p->h, t->h);
+		n.lframe = d->lframe;
+		n.buffered = d->buffered;
+		n.dirty = d->dirty || n.type != d->type ||
+			n.x != d->x || n.y != d->y || n.w != d->w ||
+			n.h != d->h || n.tex_y != d->tex_y ||
+			(n.tex_x != d->tex_x && !n.anim_on_gpu);
+		*d = n;
+	}
+}
+
+/* Where the ship is drawn; a jump of more than a block in a single step is
+ * a restart, not a flight, and is not blended */
+void interp_ship(const struct interp *ip, const struct sim_frame *f,
+		double *x, double *y)
+{
+	double s = 1 - ip->alpha,
+	       dx = f->prev_x - f->ship.x,
+	       dy = f->prev_y - f->ship.y;
+	*x = f->ship.x, *y = f->ship.y;
+	if (fabs(dx) > BLOCK_SIZE || fabs(dy) > BLOCK_SIZE)
+		return;
+	*x += s * dx;
+	*y += s * dy;
+}
+
+/* The time of blinking and animations */
+double interp_time(const struct interp *ip, const struct sim_frame *f)
+{
+	return f->time + (1 - ip->alpha) * (f->prev_time - f->time);
+}
+
+void interp_free(struct interp *ip)
+{
+	free(ip->tiles);
+	memset(ip, 0, sizeof(*ip));
+}
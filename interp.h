@@ -0,0 +1,62 @@
+/* interp.h - blending of the simulation state between fixed steps
+ * Copyright (C) 2010 Michal Trybus.
+ *
+ * This file is part of FreeCG.
+ *
+ * FreeCG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeCG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeCG. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INTERP_H
+#define INTERP_H
+
+#include "cg.h"
+#include "sim.h"
+
+/*
+ * Frames are drawn whenever the display wants them, while the simulation
+ * advances in fixed steps (see sim.h). The ship and the dynamic tiles are
+ * drawn part of the way (alpha) from where they were before the last step
+ * to where they are after it, so that their motion stays smooth at any
+ * rate.
+ *
+ * The renderer draws its own copies of the dynamic tiles, blended once per
+ * frame from the latest frame of the simulation; the tiles of the level are
+ * left to the simulation.
+ */
+struct interp {
+	/* the dynamic tiles as drawn */
+	struct tile *tiles;
+	size_t ntiles;
+	/* from 0 (before the step) to 1 (after it); 1 unless set */
+	double alpha;
+};
+
+void interp_init(struct interp*, const struct cgl*);
+void interp_blend(struct interp*, const struct sim_frame*);
+void interp_ship(const struct interp*, const struct sim_frame*, double*,
+		double*);
+double interp_time(const struct interp*, const struct sim_frame*);
+void interp_free(struct interp*);
+
+/* The copy of t drawn by the renderer */
+static inline struct tile *interp_tile(const struct interp *ip,
+		const struct cgl *l, struct tile *t)
+{
+	const struct tile *dyn = l->tiles + l->nstatic;
+	if (ip->tiles && t >= dyn && t < dyn + ip->ntiles)
+		return &ip->tiles[t - dyn];
+	return t;
+}
+
+#endif
@@ -23,6 +23,7 @@
 
 #include <assert.h>
 #include <stdlib.h>
+#include <stdint.h>
 
 #define ARRSZ(a) (sizeof(a)/sizeof(*(a)))
 enum dir {
@@ -52,6 +53,21 @@ static inline int min(int a, int b)
 {
 	return a < b ? a : b;
 }
+/* Z-order (Morton) code of a point: bits of x and y (up to 16 each)
+ * interleaved, x in the even bits */
+static inline uint32_t morton_spread(uint32_t v)
+{
+	v &= 0xffff;
+	v = (v | v << 8) & 0x00ff00ff;
+	v = (v | v << 4) & 0x0f0f0f0f;
+	v = (v | v << 2) & 0x33333333;
+	v = (v | v << 1) & 0x55555555;
+	return v;
+}
+static inline uint32_t morton(uint32_t x, uint32_t y)
+{
+	return morton_spread(x) | morton_spread(y) << 1;
+}
 static inline int sgn(double a)
 {
 	return a < 0 ? -1 : a == 0 ? 0 : 1;
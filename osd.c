@@ -20,7 +20,10 @@
 
 #include "osd.h"
 #include "graphics.h"
+#include "gfx.h"
+#include "prof.h"
 #include <math.h>
+#include <string.h>
 
 static struct cg_osd osd;
 
@@ -124,6 +127,228 @@ void osd_timer_init(struct osd_timer *t, struct osd_element *container, int w)
 	o_img(bcenter, gl.otm, 1.0,  8, 81, 1, 24);
 	o_img(bright,  gl.otm, 1.0, 13, 81, 8, 24);
 }
+enum minimap_config {
+	/* the longer side of the minimap, in px */
+	MINIMAP_SIZE = 128,
+	MARKER_SIZE = 3
+};
+/* colours in the row below the thumbnail */
+enum minimap_mark {
+	MarkShip = 0,
+	MarkHomebase,
+	MarkAirport,
+	MarkCargo,
+	MarkGate,
+	NUM_MARKS
+};
+static const Uint8 mark_colors[NUM_MARKS][4] = {
+	{255, 255, 255, 255},
+	{ 80, 140, 255, 255},
+	{ 80, 200,  80, 255},
+	{240, 200,  40, 255},
+	{220,  60,  60, 255}
+};
+/* The scale of the minimap of a level, and the size of its thumbnail */
+static void osd_minimap_size(const struct cgl *l, double *scale, int *w,
+		int *h)
+{
+	double lw = l->width * BLOCK_SIZE,
+	       lh = l->height * BLOCK_SIZE;
+	*scale = MINIMAP_SIZE / fmax(lw, lh);
+	*w = ceil(lw * *scale);
+	*h = ceil(lh * *scale);
+}
+/* The static tiles reduced to the thumbnail, each pixel as opaque as the
+ * part of the level under it is covered. Built once, so that the minimap
+ * costs a quad and its markers per frame. */
+static SDL_Surface *osd_minimap_image(const struct cgl *l)
+{
+	double scale;
+	int w, h;
+	osd_minimap_size(l, &scale, &w, &h);
+	float *cover = calloc(w * h, sizeof(*cover));
+	for (size_t k = 0; k < l->nstatic; ++k) {
+		const struct tile *t = &l->tiles[k];
+		if (t->type == Transparent)
+			continue;
+		double x0 = t->x * scale,
+		       y0 = t->y * scale,
+		       x1 = (t->x + t->w) * scale,
+		       y1 = (t->y + t->h) * scale;
+		for (int j = y0; j < min(h, (int)ceil(y1)); ++j)
+			for (int i = x0; i < min(w, (int)ceil(x1)); ++i)
+				cover[j * w + i] +=
+					(fmin(x1, i + 1) - fmax(x0, i)) *
+					(fmin(y1, j + 1) - fmax(y0, j));
+	}
+	SDL_Surface *img = SDL_CreateRGBSurface(0, w, h + 1, 32,
+			RMASK, GMASK, BMASK, AMASK);
+	for (int j = 0; j < h; ++j)
+		for (int i = 0; i < w; ++i) {
+			Uint8 *p = (Uint8*)img->pixels + j * img->pitch + 4 * i;
+			p[0] = p[1] = p[2] = 200;
+			/* thin walls would vanish otherwise */
+			p[3] = 255 * fmin(1, 2 * cover[j * w + i]);
+		}
+	for (int k = 0; k < NUM_MARKS; ++k)
+		memcpy((Uint8*)img->pixels + h * img->pitch + 4 * k,
+				mark_colors[k], 4);
+	/* copied as is into the atlas */
+	SDL_SetSurfaceBlendMode(img, SDL_BLENDMODE_NONE);
+	free(cover);
+	return img;
+}
+/* Markers are kept on whole pixels, where a texel of their colour covers
+ * them exactly */
+static inline double osd_mark_pos(const struct osd_minimap *m, double x)
+{
+	return round(x * m->scale - MARKER_SIZE / 2.0);
+}
+static void osd_marker(struct osd_minimap *m, struct osd_element *e,
+		const struct tile *t, enum minimap_mark mark)
+{
+	o_set(e, NULL,
+		pad(L, osd_mark_pos(m, t->x + t->w / 2.0)),
+		pad(T, osd_mark_pos(m, t->y + t->h / 2.0)),
+		MARKER_SIZE, MARKER_SIZE, O);
+	o_img(e, m->tm, 1, mark, m->marks_y, 1, 1);
+}
+void osd_minimap_init(struct osd_minimap *m, struct osd_element *container)
+{
+	const struct cgl *l = gl.l;
+	int w, h;
+	osd_minimap_size(l, &m->scale, &w, &h);
+	m->tm = osd.images[OSDMinimap];
+	m->marks_y = h;
+	o_dim(container, w, h, O);
+	o_img(container, m->tm, 0.6, 0, 0, w, h);
+	size_t n = 1 + l->nairports + l->ngates + l->nlgates;
+	osdlib_make_children(container, n, 0);
+	m->ship = &container->ch[0];
+	m->airports = &container->ch[1];
+	struct osd_element *gates = m->airports + l->nairports;
+	m->lgates = gates + l->ngates;
+	o_set(m->ship, NULL, pad(L,0), pad(T,0), MARKER_SIZE, MARKER_SIZE, O);
+	o_img(m->ship, m->tm, 1, MarkShip, m->marks_y, 1, 1);
+	/* over the other markers */
+	m->ship->z = 1;
+	for (size_t i = 0; i < l->nairports; ++i)
+		osd_marker(m, &m->airports[i], l->airports[i].base, MarkAirport);
+	for (size_t i = 0; i < l->ngates; ++i)
+		osd_marker(m, &gates[i], l->gates[i].base[0], MarkGate);
+	for (size_t i = 0; i < l->nlgates; ++i)
+		osd_marker(m, &m->lgates[i], l->lgates[i].base[0], MarkGate);
+}
+/* colours of the performance HUD */
+enum perf_mark {
+	/* bars of frames in time for 60 Hz, for 30 Hz, and later */
+	PerfFast = 0,
+	PerfSlow,
+	PerfLate,
+	PerfBack,
+	NUM_PERF_MARKS
+};
+static const Uint8 perf_colors[NUM_PERF_MARKS][4] = {
+	{ 80, 200,  80, 255},
+	{240, 200,  40, 255},
+	{220,  60,  60, 255},
+	{  0,   0,   0, 255}
+};
+static SDL_Surface *osd_perf_image(void)
+{
+	SDL_Surface *img = SDL_CreateRGBSurface(0, NUM_PERF_MARKS, 1, 32,
+			RMASK, GMASK, BMASK, AMASK);
+	memcpy(img->pixels, perf_colors, sizeof(perf_colors));
+	SDL_SetSurfaceBlendMode(img, SDL_BLENDMODE_NONE);
+	return img;
+}
+/* with some slack, vsync or not */
+static enum perf_mark osd_perf_mark(double ms)
+{
+	if (ms < 1.2 * 1000 / 60)
+		return PerfFast;
+	if (ms < 1.2 * 1000 / 30)
+		return PerfSlow;
+	return PerfLate;
+}
+/* Times in ms: of the frames in the graph, and of the scene (traversed and
+ * submitted) and the swap on average; the rest per frame but the
+ * candidates, per step */
+static void osd_perf_text(struct osd_perf *p)
+{
+	char str[PERF_LINES][PERF_COLUMNS + 1];
+	double times[PERF_BARS], sum = 0, max = 0;
+	size_t nt = prof_recent(ProfFrame, times, PERF_BARS);
+	for (size_t i = 0; i < nt; ++i) {
+		sum += times[i];
+		max = fmax(max, times[i]);
+	}
+	struct prof_stats scene, submit, swap;
+	prof_stats(ProfScene, &scene);
+	prof_stats(ProfSubmit, &submit);
+	prof_stats(ProfSwap, &swap);
+	double n = p->frames ? p->frames : 1;
+	snprintf(str[0], sizeof(str[0]), "FRAME %.1f MAX %.1f",
+			nt ? sum * 1e3 / nt : 0, max * 1e3);
+	snprintf(str[1], sizeof(str[1]), "DRAW %.1f SWAP %.1f",
+			(scene.mean + submit.mean) * 1e3, swap.mean * 1e3);
+	snprintf(str[2], sizeof(str[2]), "STEPS %.2f", p->steps / n);
+	snprintf(str[3], sizeof(str[3]), "TILES %.0f", p->visited / n);
+	snprintf(str[4], sizeof(str[4]), "DRAWN %.0f", p->drawn / n);
+	snprintf(str[5], sizeof(str[5]), "CANDIDATES %.0f",
+			p->candidates / n);
+	snprintf(str[6], sizeof(str[6]), "CALLS %.0f", p->calls / n);
+	for (int i = 0; i < PERF_LINES; ++i)
+		o_txt(p->lines[i], &osd.font, str[i]);
+	p->frames = 0;
+	p->steps = p->visited = p->drawn = p->candidates = p->calls = 0;
+}
+/* Hidden off the left edge until toggled */
+void osd_perf_init(struct osd_perf *p, struct osd_element *container)
+{
+	int w = 2 * 8 + PERF_COLUMNS * osd.font.w,
+	    h = 3 * 8 + PERF_HEIGHT + PERF_LINES * osd.font.h;
+	p->tm = osd.images[OSDPerf];
+	p->container = container;
+	o_set(container, NULL, pad(L,-w), pad(T,8), w, h, TS);
+	o_img(container, p->tm, 0.6, PerfBack, 0, 1, 1);
+	struct osd_element *graph, *budget;
+	osdlib_make_children(container, 1 + PERF_LINES, 0);
+	graph = &container->ch[0];
+	o_set(graph, NULL, pad(L,8), pad(T,8),
+			PERF_BARS * PERF_BAR_W, PERF_HEIGHT, TE);
+	osdlib_make_children(graph, PERF_BARS + 1, 0);
+	p->bars = graph->ch;
+	for (int i = 0; i < PERF_BARS; ++i) {
+		o_set(&p->bars[i], NULL, pad(L, i * PERF_BAR_W), pad(B,0),
+				PERF_BAR_W, 1, O);
+		o_img(&p->bars[i], p->tm, 0.8, PerfFast, 0, 1, 1);
+	}
+	/* a frame at 60 Hz, over the bars */
+	budget = &graph->ch[PERF_BARS];
+	o_set(budget, NULL, pad(L,0), pad(B, round(PERF_SCALE * 1000.0 / 60)),
+			PERF_BARS * PERF_BAR_W, 1, O);
+	o_img(budget, p->tm, 0.5, PerfFast, 0, 1, 1);
+	budget->z = 1;
+	for (int i = 0; i < PERF_LINES; ++i)
+		p->lines[i] = &container->ch[1 + i];
+	o_pos(p->lines[0], graph, pad(L,0), margin(B,8));
+	for (int i = 1; i < PERF_LINES; ++i)
+		o_pos(p->lines[i], p->lines[i-1], pad(L,0), margin(B,0));
+	osd_perf_text(p);
+}
+/* The images to pack, which the caller frees */
+void osd_images(const struct cgl *l, SDL_Surface *images[OSD_IMAGES])
+{
+	images[OSDMinimap] = osd_minimap_image(l);
+	images[OSDPerf] = osd_perf_image();
+}
+/* The images packed, for osd_init */
+void osd_set_images(struct texmgr *tms[OSD_IMAGES])
+{
+	for (int k = 0; k < OSD_IMAGES; ++k)
+		osd.images[k] = tms[k];
+}
 void osd_init()
 {
 	const struct osdlib_font f = {
@@ -136,11 +361,12 @@ void osd_init()
 	};
 	osd.font = f;
 	osd.visible = 0;
-	struct osd_element *orect, *opanel, *otimer, *ogameover, *ovictory;
+	struct osd_element *orect, *opanel, *otimer, *ogameover, *ovictory,
+			   *omap, *operf;
 	osd.layer = calloc(1, sizeof(*osd.layer));
 	osdlib_init(osd.layer, gl.win_w, gl.win_h);
-	osdlib_make_children(osd.layer->root, 5, 1,
-		&orect, &opanel, &otimer, &ogameover, &ovictory);
+	osdlib_make_children(osd.layer->root, 7, 1,
+		&orect, &opanel, &otimer, &ogameover, &ovictory, &omap, &operf);
 	osd.shipinfo.container = orect;
 	osd.panel.container = opanel;
 	osd.timer.container = otimer;
@@ -173,6 +399,11 @@ void osd_init()
 	/* timer */
 	o_pos(otimer, NULL, center(), pad(T,-32));
 	osd_timer_init(&osd.timer, otimer, 96);
+	/* minimap */
+	o_pos(omap, NULL, pad(R,8), pad(T,8));
+	osd_minimap_init(&osd.minimap, omap);
+	/* performance HUD */
+	osd_perf_init(&osd.perf, operf);
 	osd_show();
 
 	/* DEPRECATED (labels will go to menu) */
@@ -233,7 +464,7 @@ void osd_keys_step(struct osd_keys *k, const int *keys)
 			k->keys[i].a = 0.2;
 			k->keys[i].tex_x = 256;
 		} else {
-			k->keys[i].tex_x = 256 + 16 * ((int)(gl.l->time*KEY_ANIM_SPEED + i) % 8);
+			k->keys[i].tex_x = 256 + 16 * ((int)(gl.state->time*KEY_ANIM_SPEED + i) % 8);
 			k->keys[i].a = 0.8;
 		}
 	}
@@ -290,26 +521,72 @@ void osd_timer_step(struct osd_timer *t, double time)
 	sprintf(time_str, "%.2d:%.2d", min, sec);
 	o_txt(t->time, &osd.font, time_str);
 }
+/* Only the markers change */
+void osd_minimap_step(struct osd_minimap *m)
+{
+	const struct cgl *l = gl.l;
+	const struct sim_frame *f = gl.state;
+	m->ship->x.v = osd_mark_pos(m, f->ship.x + SHIP_W / 2.0);
+	m->ship->y.v = osd_mark_pos(m, f->ship.y + SHIP_H / 2.0);
+	for (size_t i = 0; i < l->nairports; ++i) {
+		const struct airport *ap = &l->airports[i];
+		m->airports[i].tex_x = ap == l->hb ? MarkHomebase :
+			f->cargo[i] ? MarkCargo : MarkAirport;
+	}
+	for (size_t i = 0; i < l->nlgates; ++i)
+		m->lgates[i].tr = f->open[i] ? TE : O;
+}
+/* The counters are always kept, the HUD shown or not; the graph and the
+ * text are updated only while it is */
+void osd_perf_step(struct osd_perf *p, double time)
+{
+	const struct sim_frame *f = gl.state;
+	++p->frames;
+	p->steps += f->step - p->step;
+	p->step = f->step;
+	p->visited += gl.counts.visited;
+	p->drawn += gl.counts.drawn;
+	p->candidates += f->candidates;
+	p->calls += gl.counts.calls;
+	struct osd_element *c = p->container;
+	if (!p->visible) {
+		/* out of sight once slid away */
+		if (c->x.v <= -c->w)
+			c->tr = TransparentSubtree;
+		return;
+	}
+	double times[PERF_BARS];
+	size_t n = prof_recent(ProfFrame, times, PERF_BARS);
+	for (size_t i = 0; i < PERF_BARS; ++i) {
+		double t = i < PERF_BARS - n ? 0 :
+			times[i - (PERF_BARS - n)] * 1e3;
+		p->bars[i].h = fmax(1, fmin(PERF_HEIGHT, PERF_SCALE * t));
+		p->bars[i].tex_x = osd_perf_mark(t);
+	}
+	if (time >= p->refresh) {
+		osd_perf_text(p);
+		p->refresh = time + 1.0 / PERF_REFRESH;
+	}
+}
 void osd_step(double time)
 {
-	struct ship *ship = gl.l->ship;
+	const struct sim_frame *f = gl.state;
+	const struct ship *ship = &f->ship;
 	osd_fuel_step(&osd.shipinfo.fuel, ship->fuel);
 	osd_velocity_step(&osd.shipinfo.velocity, ship->vx, ship->vy,
 			ship->max_vx, ship->max_vy);
 	osd_keys_step(&osd.shipinfo.keys, ship->keys);
-	size_t nfreight = cg_freight_remaining(gl.l);
-	struct freight freight[nfreight];
-	cg_get_freight_airports(gl.l, freight);
-	osd_freight_step(&osd.panel.lfreight, freight, nfreight);
+	osd_freight_step(&osd.panel.lfreight, f->freight, f->nfreight);
 	osd.panel.sfreight.max_freight = ship->max_freight;
 	osd_freight_step(&osd.panel.sfreight, ship->freight, ship->num_freight);
-	struct airport *hb = gl.l->hb;
-	osd_freight_step(&osd.panel.hbfreight, hb->c.freight, hb->num_cargo);
-	osd_life_step(&osd.panel.life, max(0, gl.l->ship->life));
+	osd_freight_step(&osd.panel.hbfreight, f->hb_freight, f->hb_cargo);
+	osd_life_step(&osd.panel.life, max(0, ship->life));
 	osd_timer_step(&osd.timer, time);
-	if (gl.l->status == Victory)
+	osd_minimap_step(&osd.minimap);
+	osd_perf_step(&osd.perf, time);
+	if (f->status == Victory)
 		osd.victory->tr = Opaque;
-	if (gl.l->status == Lost)
+	if (f->status == Lost)
 		osd.gameover->tr = Opaque;
 	osdlib_step(osd.layer, time);
 }
@@ -357,3 +634,24 @@ void osd_toggle()
 	else
 		osd_show();
 }
+/* The elements are laid out anew from the root on every draw */
+void osd_resize(double w, double h)
+{
+	osd.layer->w = w, osd.layer->h = h;
+}
+void osd_perf_toggle()
+{
+	struct osd_perf *p = &osd.perf;
+	double t = osd.layer->time,
+	       w = p->container->w;
+	struct animation *a;
+	if (p->visible)
+		a = anim(Abs, Abs, &p->container->x.v, ease_atan,
+				8, -w, t, t+0.5);
+	else
+		a = anim(Abs, Abs, &p->container->x.v, ease_atan,
+				-w, 8, t, t+0.5);
+	osdlib_add_animation(osd.layer, a);
+	p->container->tr = Opaque;
+	p->visible = !p->visible;
+}
@@ -21,6 +21,8 @@
 #define OSD_H
 
 #include "osdlib.h"
+#include "cgl.h"
+#include <SDL2/SDL.h>
 
 struct osd_fuel {
 	size_t old_nfuel;
@@ -64,20 +66,71 @@ struct osd_timer {
 	struct osd_element *container;
 	struct osd_element *time;
 };
+struct osd_minimap {
+	/* minimap px per level px */
+	double scale;
+	/* the thumbnail, with a row of marker colours below it */
+	struct texmgr *tm;
+	int marks_y;
+	struct osd_element *ship,
+			   *airports,
+			   *lgates;
+};
+/* The performance HUD: a graph of the last frame times of prof.h, newest
+ * on the right, and the work done per frame, averaged between refreshes
+ * of the text */
+enum osd_perf_config {
+	PERF_BARS = 64,
+	PERF_BAR_W = 3,
+	/* px per ms of a bar, and the tallest bar */
+	PERF_SCALE = 2,
+	PERF_HEIGHT = 80,
+	/* times the text is refreshed per second */
+	PERF_REFRESH = 4,
+	PERF_LINES = 7,
+	PERF_COLUMNS = 20
+};
+struct osd_perf {
+	int visible;
+	struct osd_element *container;
+	struct texmgr *tm;
+	struct osd_element *bars,
+			   *lines[PERF_LINES];
+	/* the step the last frame showed */
+	unsigned long step;
+	/* since the text was refreshed */
+	double refresh;
+	unsigned int frames;
+	unsigned long steps, visited, drawn, candidates, calls;
+};
+/* Images of the OSD drawn at load, packed into the atlas with the others
+ * (see tm_request_atlas) before osd_init */
+enum osd_image {
+	/* the thumbnail of the minimap */
+	OSDMinimap,
+	/* the colours of the performance HUD */
+	OSDPerf,
+	OSD_IMAGES
+};
 struct cg_osd {
 	int visible;
 	struct osd_layer *layer;
+	struct texmgr *images[OSD_IMAGES];
 	struct osdlib_font font;
 
 	struct osd_shipinfo shipinfo;
 	struct osd_panel    panel;
 	struct osd_timer    timer;
+	struct osd_minimap  minimap;
+	struct osd_perf     perf;
 
 	/* deprecated */
 	struct osd_element *victory,
 			   *gameover;
 };
 
+void osd_images(const struct cgl*, SDL_Surface*[OSD_IMAGES]);
+void osd_set_images(struct texmgr*[OSD_IMAGES]);
 void osd_init();
 void osd_step();
 void osd_draw();
@@ -85,5 +138,7 @@ void osd_free();
 void osd_show();
 void osd_hide();
 void osd_toggle();
+void osd_perf_toggle();
+void osd_resize(double, double);
 
 #endif
@@ -186,22 +186,8 @@ void osdlib_draw_rec(struct osd_layer *l, struct osd_element *e)
 {
 	osdlib_count_absolute(l, e);
 	if (e->tr == Opaque) {
-		gl_bind_texture(e->t);
-		glBegin(GL_QUADS);
-		glColor4f(1, 1, 1, e->a);
-		tm_coord_tl(e->t, e->tex_x, e->tex_y,
-				e->tex_w, e->tex_h);
-		glVertex3d(e->rx, e->ry, e->rz);
-		tm_coord_bl(e->t, e->tex_x, e->tex_y,
-				e->tex_w, e->tex_h);
-		glVertex3d(e->rx, e->ry + e->rh, e->rz);
-		tm_coord_br(e->t, e->tex_x, e->tex_y,
-				e->tex_w, e->tex_h);
-		glVertex3d(e->rx + e->rw, e->ry + e->rh, e->rz);
-		tm_coord_tr(e->t, e->tex_x, e->tex_y,
-				e->tex_w, e->tex_h);
-		glVertex3d(e->rx + e->rw, e->ry, e->rz);
-		glEnd();
+		gl_draw_quad(e->t, e->rx, e->ry, e->rw, e->rh, e->rz,
+				e->tex_x, e->tex_y, e->tex_w, e->tex_h, e->a);
 	}
 	if (e->tr != TransparentSubtree) {
 		/* recurse into the children */
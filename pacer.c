@@ -0,0 +1,77 @@
+/* pacer.c - frame pacing with a high-resolution clock
+ * Copyright (C) 2010 Michal Trybus.
+ *
+ * This file is part of FreeCG.
+ *
+ * FreeCG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeCG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeCG. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pacer.h"
+
+/* A rate of 0 is that of vsync or, failing it, of the display; vsync is
+ * tried only if the window has a current GL context */
+void pacer_init(struct pacer *p, SDL_Window *window, int rate, int vsync)
+{
+	SDL_DisplayMode mode;
+	p->freq = SDL_GetPerformanceFrequency();
+	p->vsync = 0;
+	if (vsync && SDL_GL_GetCurrentContext())
+		/* late frames tear rather than wait for the next one, if the
+		 * driver allows */
+		p->vsync = SDL_GL_SetSwapInterval(-1) == 0 ||
+			SDL_GL_SetSwapInterval(1) == 0;
+	else if (SDL_GL_GetCurrentContext())
+		SDL_GL_SetSwapInterval(0);
+	p->rate = rate > 0 ? rate :
+		SDL_GetWindowDisplayMode(window, &mode) == 0 &&
+		mode.refresh_rate > 0 ? mode.refresh_rate : PACER_RATE;
+	p->period = rate > 0 || !p->vsync ? p->freq / p->rate : 0;
+	p->slack = p->freq / 1000;
+	p->start = p->next = SDL_GetPerformanceCounter();
+}
+
+/* Seconds since pacer_init */
+double pacer_time(const struct pacer *p)
+{
+	return (double)(SDL_GetPerformanceCounter() - p->start) / p->freq;
+}
+
+/* Waits for the deadline of the next frame, after the present */
+void pacer_wait(struct pacer *p)
+{
+	if (!p->period)
+		return;
+	p->next += p->period;
+	Uint64 now = SDL_GetPerformanceCounter();
+	if (now >= p->next) {
+		/* more than a frame behind: start over rather than hurry */
+		if (now - p->next > p->period)
+			p->next = now;
+		return;
+	}
+	Sint64 left = p->next - now - p->slack;
+	Uint32 ms = left > 0 ? left * 1000 / p->freq : 0;
+	if (ms) {
+		SDL_Delay(ms);
+		Uint64 woke = SDL_GetPerformanceCounter();
+		Sint64 over = (Sint64)(woke - now) - (Sint64)(ms * p->freq / 1000);
+		p->slack += (over - p->slack) / PACER_LEARN;
+		if (p->slack < 0)
+			p->slack = 0;
+		if (p->slack > (Sint64)p->period)
+			p->slack = p->period;
+	}
+	while (SDL_GetPerformanceCounter() < p->next)
+		;
+}
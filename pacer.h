@@ -0,0 +1,53 @@
+/* pacer.h - frame pacing with a high-resolution clock
+ * Copyright (C) 2010 Michal Trybus.
+ *
+ * This file is part of FreeCG.
+ *
+ * FreeCG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeCG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeCG. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PACER_H
+#define PACER_H
+
+#include <SDL2/SDL.h>
+
+/*
+ * Frames are started at fixed deadlines of the performance counter. The
+ * pacer sleeps for most of the time left, in whole milliseconds, and spins
+ * for the rest; how much longer than asked SDL_Delay sleeps is learnt as
+ * it goes, so that the spin stays short. With vsync and no target rate of
+ * its own, the swap alone paces the frames.
+ */
+enum pacer_config {
+	/* frames per second when neither vsync nor the display tell */
+	PACER_RATE = 60,
+	/* weight (1/n) of each oversleep in the running estimate */
+	PACER_LEARN = 8
+};
+struct pacer {
+	/* frames per second, as asked or of the display */
+	int rate;
+	/* counts per second, per frame (0 if not paced) */
+	Uint64 freq, period;
+	Uint64 start, next;
+	/* expected oversleep of SDL_Delay, in counts */
+	Sint64 slack;
+	int vsync;
+};
+
+void pacer_init(struct pacer*, SDL_Window*, int, int);
+double pacer_time(const struct pacer*);
+void pacer_wait(struct pacer*);
+
+#endif
@@ -0,0 +1,130 @@
+/* prof.c - phase timers with rolling histograms
+ * Copyright (C) 2010 Michal Trybus.
+ *
+ * This file is part of FreeCG.
+ *
+ * FreeCG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeCG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeCG. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "prof.h"
+
+struct prof_hist prof[ProfPhases];
+
+static const char *names[ProfPhases] = {
+	"events", "step", "animate", "objects", "ship", "collisions",
+	"scene", "osd_step", "osd_draw", "submit", "swap", "frame"
+};
+
+static inline int bucket(Uint32 us)
+{
+	int k = 0;
+	for (; us; us >>= 1)
+		++k;
+	return k;
+}
+
+/* Adds a time, in counts of the performance counter */
+void prof_add(enum prof_phase phase, Uint64 counts)
+{
+	struct prof_hist *h = &prof[phase];
+	Uint64 us = counts * 1000000 / SDL_GetPerformanceFrequency();
+	Uint32 t = us < 1u << (PROF_BUCKETS - 1) ? us :
+		(1u << (PROF_BUCKETS - 1)) - 1;
+	if (SDL_AtomicGet(&h->count) == PROF_WINDOW) {
+		Uint32 old = h->times[h->next];
+		SDL_AtomicAdd(&h->buckets[bucket(old)], -1);
+		SDL_AtomicAdd(&h->sum, -(int)old);
+	} else {
+		SDL_AtomicAdd(&h->count, 1);
+	}
+	h->times[h->next] = t;
+	h->next = (h->next + 1) % PROF_WINDOW;
+	SDL_AtomicSet(&h->last, t);
+	SDL_AtomicAdd(&h->buckets[bucket(t)], 1);
+	SDL_AtomicAdd(&h->sum, t);
+}
+
+/* A phase from start to end, readings of the performance counter */
+void prof_span(enum prof_phase phase, Uint64 start, Uint64 end)
+{
+	prof_add(phase, end - start);
+	if (trace_on)
+		trace_span(names[phase], start, end);
+}
+
+/* The percentiles are the upper bounds of the buckets they fall in */
+void prof_stats(enum prof_phase phase, struct prof_stats *s)
+{
+	struct prof_hist *h = &prof[phase];
+	int n[PROF_BUCKETS], total = 0;
+	for (int k = 0; k < PROF_BUCKETS; ++k)
+		total += n[k] = SDL_AtomicGet(&h->buckets[k]);
+	s->count = SDL_AtomicGet(&h->count);
+	s->mean = total ? SDL_AtomicGet(&h->sum) / 1e6 / total : 0;
+	s->last = SDL_AtomicGet(&h->last) / 1e6;
+	s->p50 = s->p99 = s->max = 0;
+	for (int k = 0, below = 0; k < PROF_BUCKETS; ++k) {
+		if (!n[k])
+			continue;
+		double bound = (1u << k) / 1e6;
+		below += n[k];
+		if (!s->p50 && below * 2 >= total)
+			s->p50 = bound;
+		if (!s->p99 && below * 100 >= total * 99)
+			s->p99 = bound;
+		s->max = bound;
+	}
+}
+
+/* The time added last, in seconds */
+double prof_last(enum prof_phase phase)
+{
+	return SDL_AtomicGet(&prof[phase].last) / 1e6;
+}
+
+/* The last n times or fewer, oldest first, in seconds; for the timing
+ * thread only. Returns how many there were. */
+size_t prof_recent(enum prof_phase phase, double *times, size_t n)
+{
+	struct prof_hist *h = &prof[phase];
+	size_t count = SDL_AtomicGet(&h->count);
+	if (n > count)
+		n = count;
+	for (size_t i = 0; i < n; ++i)
+		times[i] = h->times[(h->next + PROF_WINDOW - n + i) %
+			PROF_WINDOW] / 1e6;
+	return n;
+}
+
+const char *prof_name(enum prof_phase phase)
+{
+	return names[phase];
+}
+
+/* A table of all phases, in milliseconds */
+void prof_print(FILE *fp)
+{
+	fprintf(fp, "%-12s %8s %8s %8s %8s %8s\n", "phase", "last", "mean",
+			"p50<", "p99<", "max<");
+	for (int p = 0; p < ProfPhases; ++p) {
+		struct prof_stats s;
+		prof_stats(p, &s);
+		if (!s.count)
+			continue;
+		fprintf(fp, "%-12s %8.3f %8.3f %8.3f %8.3f %8.3f\n",
+				names[p], s.last * 1e3, s.mean * 1e3,
+				s.p50 * 1e3, s.p99 * 1e3, s.max * 1e3);
+	}
+	fflush(fp);
+}
@@ -0,0 +1,97 @@
+/* prof.h - phase timers with rolling histograms
+ * Copyright (C) 2010 Michal Trybus.
+ *
+ * This file is part of FreeCG.
+ *
+ * FreeCG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeCG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeCG. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PROF_H
+#define PROF_H
+
+#include <stdio.h>
+#include <SDL2/SDL.h>
+#include "trace.h"
+
+/*
+ * Phases of the frame and of the simulation step are timed with the
+ * performance counter, always: a reading costs tens of nanoseconds. The
+ * last PROF_WINDOW times of each phase are kept, with a histogram of them
+ * in buckets of powers of two microseconds, updated as times come and go,
+ * so statistics can be asked for at any time, from any thread.
+ *
+ * Each phase is timed by one thread only: the simulation's are those of
+ * cg_step. While tracing (see trace.h) every time is a span, too.
+ */
+enum prof_config {
+	/* times kept per phase */
+	PROF_WINDOW = 256,
+	/* bucket k holds times below 2^k us; longer ones are cut to the last,
+	 * so that a window of them still sums up in an int */
+	PROF_BUCKETS = 24
+};
+enum prof_phase {
+	ProfEvents,
+	/* cg_step, and its parts */
+	ProfStep,
+	ProfAnimate,
+	ProfObjects,
+	ProfShip,
+	ProfCollisions,
+	/* gl_build_scene */
+	ProfScene,
+	ProfOSDStep,
+	ProfOSDDraw,
+	/* sorting and submission of the drawlist */
+	ProfSubmit,
+	ProfSwap,
+	/* from the start of a frame to that of the next */
+	ProfFrame,
+	ProfPhases
+};
+struct prof_hist {
+	/* in us, owned by the timing thread */
+	Uint32 times[PROF_WINDOW];
+	size_t next;
+	/* of the times kept */
+	SDL_atomic_t count, sum, buckets[PROF_BUCKETS];
+	SDL_atomic_t last;
+};
+/* In seconds, over the times kept */
+struct prof_stats {
+	size_t count;
+	double last, mean, p50, p99, max;
+};
+
+extern struct prof_hist prof[ProfPhases];
+
+void prof_add(enum prof_phase, Uint64);
+void prof_span(enum prof_phase, Uint64, Uint64);
+void prof_stats(enum prof_phase, struct prof_stats*);
+double prof_last(enum prof_phase);
+size_t prof_recent(enum prof_phase, double*, size_t);
+const char *prof_name(enum prof_phase);
+void prof_print(FILE*);
+
+/* Times a phase: t = prof_begin(); ...; prof_end(phase, t) */
+static inline Uint64 prof_begin(void)
+{
+	return SDL_GetPerformanceCounter();
+}
+static inline void prof_end(enum prof_phase phase, Uint64 start)
+{
+	prof_span(phase, start, SDL_GetPerformanceCounter());
+}
+
+#endif
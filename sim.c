@@ -0,0 +1,349 @@
+/* sim.c - the simulation, stepped apart from the renderer
+ * Copyright (C) 2010 Michal Trybus.
+ *
+ * This file is part of FreeCG.
+ *
+ * FreeCG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeCG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeCG. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sim.h"
+#include "pacer.h"
+#include "trace.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* set in ready while the frame there is newer than the reader's */
+#define SIM_FRESH 4
+
+static struct interp_geom geom(const struct tile *t)
+{
+	return (struct interp_geom){t->x, t->y, t->w, t->h, t->tex_x, t->tex_y};
+}
+
+/* The state before a step */
+static void sim_save(struct sim *s, struct sim_frame *f)
+{
+	const struct cgl *l = s->l;
+	for (size_t k = 0; k < s->ntiles; ++k)
+		f->prev[k] = geom(&l->tiles[l->nstatic + k]);
+	f->prev_x = l->ship->x;
+	f->prev_y = l->ship->y;
+	f->prev_time = l->time;
+}
+/* The state after it; the dirty flags of the level are taken over, the
+ * renderer finds what changed by itself */
+static void sim_fill(struct sim *s, struct sim_frame *f)
+{
+	struct cgl *l = s->l;
+	for (size_t k = 0; k < s->ntiles; ++k) {
+		struct tile *t = &l->tiles[l->nstatic + k];
+		f->tiles[k] = *t;
+		t->dirty = 0;
+	}
+	f->time = l->time;
+	f->due = s->due;
+	f->ship = *l->ship;
+	f->ship.freight = f->ship_freight;
+	memcpy(f->ship_freight, l->ship->freight,
+			l->ship->num_freight * sizeof(*f->ship_freight));
+	f->status = l->status;
+	f->nfreight = cg_freight_remaining(l);
+	cg_get_freight_airports(l, f->freight);
+	f->hb_cargo = l->hb->num_cargo;
+	memcpy(f->hb_freight, l->hb->c.freight,
+			f->hb_cargo * sizeof(*f->hb_freight));
+	for (size_t i = 0; i < l->nairports; ++i)
+		f->cargo[i] = l->airports[i].num_cargo;
+	for (size_t i = 0; i < l->nlgates; ++i)
+		f->open[i] = l->lgates[i].open;
+	f->step = s->step;
+	f->candidates = l->candidates;
+}
+/* Hands the frame written over to the reader */
+static void sim_publish(struct sim *s)
+{
+	/* the frame is written before it is handed over, and the one taken
+	 * back is read by the reader before it is written again */
+	SDL_MemoryBarrierRelease();
+	s->back = SDL_AtomicSet(&s->ready, s->back | SIM_FRESH) & ~SIM_FRESH;
+	SDL_MemoryBarrierAcquire();
+}
+
+static void sim_apply(struct sim *s, const struct sim_input *in)
+{
+	struct ship *ship = s->l->ship;
+	if (s->record)
+		fprintf(s->record, "%lu %d %d %.17g\n", s->step, in->action,
+				in->n, in->v);
+	switch (in->action) {
+	case SimEngine:
+		cg_ship_set_engine(ship, in->n);
+		break;
+	case SimRotate:
+		ship->rot_speed = in->v;
+		break;
+	case SimRotateEnd:
+		if (ship->rot_speed == in->v)
+			ship->rot_speed = 0;
+		break;
+	case SimKey:
+		if (in->n >= 0 && in->n < 4)
+			ship->keys[in->n] = !ship->keys[in->n];
+		break;
+	}
+}
+/* Applies the inputs up to due, when the step is due, then takes it;
+ * later ones wait for the next step */
+static void sim_step(struct sim *s, Uint64 due)
+{
+	int head = SDL_AtomicGet(&s->head),
+	    tail = SDL_AtomicGet(&s->tail);
+	/* the inputs up to tail are written */
+	SDL_MemoryBarrierAcquire();
+	for (; head != tail; head = (head + 1) % SIM_QUEUE) {
+		const struct sim_input *in = &s->queue[head];
+		if ((Sint64)(in->time - due) > 0)
+			break;
+		if (!s->replay)
+			sim_apply(s, in);
+		/* and read before their slots are given back */
+		SDL_MemoryBarrierRelease();
+		SDL_AtomicSet(&s->head, (head + 1) % SIM_QUEUE);
+	}
+	for (; s->ireplay < s->nreplay &&
+	       s->replay[s->ireplay].step <= s->step; ++s->ireplay)
+		sim_apply(s, &s->replay[s->ireplay].in);
+	struct sim_frame *f = &s->frames[s->back];
+	sim_save(s, f);
+	cg_step(s->l, s->l->time + SIM_STEP);
+	++s->step;
+}
+
+int sim_init(struct sim *s, struct cgl *l)
+{
+	memset(s, 0, sizeof(*s));
+	s->l = l;
+	s->ntiles = l->ntiles - l->nstatic;
+	for (int i = 0; i < 3; ++i) {
+		struct sim_frame *f = &s->frames[i];
+		f->tiles = malloc((s->ntiles + 1) * sizeof(*f->tiles));
+		f->prev = malloc((s->ntiles + 1) * sizeof(*f->prev));
+		f->ship_freight = malloc((l->num_all_freight + 1) *
+				sizeof(*f->ship_freight));
+		f->freight = malloc((l->num_all_freight + 1) *
+				sizeof(*f->freight));
+		f->cargo = malloc((l->nairports + 1) * sizeof(*f->cargo));
+		f->open = malloc(l->nlgates + 1);
+		if (!f->tiles || !f->prev || !f->ship_freight || !f->freight ||
+		    !f->cargo || !f->open) {
+			sim_free(s);
+			SDL_SetError("Out of memory");
+			return -1;
+		}
+	}
+	s->freq = SDL_GetPerformanceFrequency();
+	s->period = s->freq / SIM_RATE;
+	s->due = SDL_GetPerformanceCounter();
+	/* nothing moved before the first step */
+	s->back = 0;
+	s->front = 1;
+	SDL_AtomicSet(&s->ready, 2);
+	sim_save(s, &s->frames[1]);
+	sim_fill(s, &s->frames[1]);
+	return 0;
+}
+
+/* Takes the steps due by now, no more than SIM_MAX_STEPS of them; 0 if none
+ * was due */
+static int sim_catch_up(struct sim *s)
+{
+	Uint64 now = SDL_GetPerformanceCounter();
+	if (now - s->due > SIM_MAX_STEPS * s->period)
+		s->due = now - SIM_MAX_STEPS * s->period;
+	if (now - s->due < s->period)
+		return 0;
+	/* due ends up at the time simulated, less than a step ago */
+	for (; now - s->due >= s->period; s->due += s->period)
+		sim_step(s, s->due + s->period);
+	return 1;
+}
+
+static int sim_thread(void *data)
+{
+	struct sim *s = data;
+	struct pacer pacer;
+	trace_thread("sim");
+	/* there is no GL context on this thread, nor a display to follow */
+	pacer_init(&pacer, NULL, SIM_RATE, 0);
+	while (!SDL_AtomicGet(&s->quit)) {
+		if (sim_catch_up(s)) {
+			sim_fill(s, &s->frames[s->back]);
+			sim_publish(s);
+		}
+		/* wake when the next step is due */
+		pacer.next = s->due;
+		pacer_wait(&pacer);
+	}
+	return 0;
+}
+/* The level is the simulation's from now on; returns -1 if the thread could
+ * not be created, in which case sim_update keeps stepping it */
+int sim_start(struct sim *s)
+{
+	s->thread = SDL_CreateThread(sim_thread, "sim", s);
+	return s->thread ? 0 : -1;
+}
+
+/* Writes the inputs applied from now on to file */
+int sim_record(struct sim *s, const char *file)
+{
+	s->record = fopen(file, "w");
+	if (!s->record) {
+		SDL_SetError("Cannot open %s", file);
+		return -1;
+	}
+	return 0;
+}
+/* Applies the inputs recorded in file instead of those pushed */
+int sim_replay(struct sim *s, const char *file)
+{
+	FILE *fp = fopen(file, "r");
+	if (!fp) {
+		SDL_SetError("Cannot open %s", file);
+		return -1;
+	}
+	size_t size = 0;
+	struct sim_record r;
+	int action;
+	memset(&r, 0, sizeof(r));
+	while (fscanf(fp, "%lu %d %d %lf", &r.step, &action, &r.in.n,
+				&r.in.v) == 4) {
+		if (s->nreplay == size) {
+			size = size ? 2 * size : 64;
+			struct sim_record *replay = realloc(s->replay,
+					size * sizeof(*replay));
+			if (!replay) {
+				fclose(fp);
+				SDL_SetError("Out of memory");
+				return -1;
+			}
+			s->replay = replay;
+		}
+		r.in.action = action;
+		s->replay[s->nreplay++] = r;
+	}
+	int bad = !feof(fp);
+	fclose(fp);
+	if (bad) {
+		SDL_SetError("%s: bad input at line %lu", file,
+				(unsigned long)s->nreplay + 1);
+		return -1;
+	}
+	/* nothing to replay is still a replay, of no input */
+	if (!s->replay && !(s->replay = malloc(sizeof(*s->replay)))) {
+		SDL_SetError("Out of memory");
+		return -1;
+	}
+	return 0;
+}
+
+/* The performance counter at an SDL event timestamp, in milliseconds of
+ * SDL_GetTicks */
+Uint64 sim_event_time(const struct sim *s, Uint32 timestamp)
+{
+	Uint64 now = SDL_GetPerformanceCounter();
+	Uint32 age = SDL_GetTicks() - timestamp;
+	return now - (Uint64)age * s->freq / 1000;
+}
+
+/* Queues an input for the step due after it; -1 if the queue is full */
+int sim_push(struct sim *s, const struct sim_input *in)
+{
+	int tail = SDL_AtomicGet(&s->tail),
+	    next = (tail + 1) % SIM_QUEUE;
+	if (next == SDL_AtomicGet(&s->head))
+		return -1;
+	/* the slot is read by the thread before it is written again */
+	SDL_MemoryBarrierAcquire();
+	s->queue[tail] = *in;
+	SDL_MemoryBarrierRelease();
+	SDL_AtomicSet(&s->tail, next);
+	return 0;
+}
+
+/* Takes the steps due by now, unless the thread does */
+void sim_update(struct sim *s)
+{
+	if (s->thread)
+		return;
+	if (!sim_catch_up(s))
+		return;
+	sim_fill(s, &s->frames[s->back]);
+	sim_publish(s);
+}
+
+/* Takes n steps now, whether due or not, unless the thread does; for runs
+ * that must not depend on the clock */
+void sim_run(struct sim *s, int n)
+{
+	if (s->thread)
+		return;
+	s->due = SDL_GetPerformanceCounter();
+	for (int i = 0; i < n; ++i)
+		sim_step(s, s->due);
+	sim_fill(s, &s->frames[s->back]);
+	sim_publish(s);
+}
+
+/* The latest frame, the reader's until the next call */
+const struct sim_frame *sim_acquire(struct sim *s)
+{
+	if (SDL_AtomicGet(&s->ready) & SIM_FRESH) {
+		/* as sim_publish, the other way round */
+		SDL_MemoryBarrierRelease();
+		s->front = SDL_AtomicSet(&s->ready, s->front) & ~SIM_FRESH;
+		SDL_MemoryBarrierAcquire();
+	}
+	return &s->frames[s->front];
+}
+
+/* How far from the state before the step of f to that after it the frame
+ * drawn now should be, from 0 to 1 */
+double sim_alpha(const struct sim *s, const struct sim_frame *f)
+{
+	Sint64 since = SDL_GetPerformanceCounter() - f->due;
+	double alpha = (double)since / s->period;
+	return alpha < 0 ? 0 : alpha > 1 ? 1 : alpha;
+}
+
+void sim_free(struct sim *s)
+{
+	if (s->thread) {
+		SDL_AtomicSet(&s->quit, 1);
+		SDL_WaitThread(s->thread, NULL);
+	}
+	if (s->record)
+		fclose(s->record);
+	free(s->replay);
+	for (int i = 0; i < 3; ++i) {
+		struct sim_frame *f = &s->frames[i];
+		free(f->tiles);
+		free(f->prev);
+		free(f->ship_freight);
+		free(f->freight);
+		free(f->cargo);
+		free(f->open);
+	}
+	memset(s, 0, sizeof(*s));
+}
@@ -0,0 +1,149 @@
+/* sim.h - the simulation, stepped apart from the renderer
+ * Copyright (C) 2010 Michal Trybus.
+ *
+ * This file is part of FreeCG.
+ *
+ * FreeCG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeCG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeCG. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SIM_H
+#define SIM_H
+
+#include "cg.h"
+#include <stdio.h>
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_thread.h>
+
+/*
+ * The simulation advances in fixed steps of SIM_STEP on a thread of its own
+ * and owns the level while it runs. After every step it fills a frame with
+ * what the renderer needs -- the ship, the dynamic tiles before and after
+ * the step and the values shown by the OSD -- and publishes it through a
+ * triple buffer: one frame is written, one is read and the third holds the
+ * latest published, exchanged with a single atomic swap, so neither side
+ * ever waits for the other. Input goes the other way through a
+ * single-producer single-consumer ring, stamped with the time it happened
+ * at, and is applied before the first step due after it, however late the
+ * steps are taken.
+ *
+ * The inputs applied may be recorded with the number of the step they were
+ * applied at, one per line, and replayed: the steps are fixed and the bars
+ * draw from rand(), which nothing seeds, so a replay of the same level takes
+ * exactly the same course.
+ *
+ * Streamed levels load tiles into the grid the collisions are checked
+ * against, as the view moves, so for them the steps are taken on the main
+ * thread by sim_update instead.
+ */
+enum sim_config {
+	/* steps of the simulation per second */
+	SIM_RATE = 60,
+	/* steps taken at most per update; more are dropped, slowing the game
+	 * down rather than falling further behind */
+	SIM_MAX_STEPS = 8,
+	/* inputs waiting for the next step */
+	SIM_QUEUE = 64
+};
+#define SIM_STEP (1.0 / SIM_RATE)
+
+/* what changes when a tile slides */
+struct interp_geom {
+	int x, y;
+	unsigned short w, h;
+	short tex_x, tex_y;
+};
+/* The state after a step, never changed once published */
+struct sim_frame {
+	/* of the level, after the step and before it */
+	double time, prev_time;
+	/* performance counter at which the step was due */
+	Uint64 due;
+	/* ship.freight points into freight[] below */
+	struct ship ship;
+	double prev_x, prev_y;
+	/* the dynamic tiles, in the order of the level */
+	struct tile *tiles;
+	struct interp_geom *prev;
+	/* what the OSD shows */
+	enum game_status status;
+	struct freight *ship_freight;
+	/* waiting at the freight airports, as by cg_get_freight_airports */
+	struct freight *freight;
+	size_t nfreight;
+	struct freight hb_freight[10];
+	size_t hb_cargo;
+	/* per airport and light gate of the level */
+	size_t *cargo;
+	unsigned char *open;
+	/* what the performance HUD shows: steps taken so far, tiles tested
+	 * for collisions by the last */
+	unsigned long step;
+	size_t candidates;
+};
+enum sim_action {
+	/* the engine on (n = 1) or off */
+	SimEngine,
+	/* rotation at v; SimRotateEnd stops it if still at v */
+	SimRotate,
+	SimRotateEnd,
+	/* key n toggled */
+	SimKey
+};
+struct sim_input {
+	enum sim_action action;
+	int n;
+	double v;
+	/* performance counter when it happened */
+	Uint64 time;
+};
+/* An input as recorded, applied before the step-th step */
+struct sim_record {
+	unsigned long step;
+	struct sim_input in;
+};
+struct sim {
+	struct cgl *l;
+	size_t ntiles;
+	struct sim_frame frames[3];
+	/* latest published, with SIM_FRESH if not taken by the reader yet */
+	SDL_atomic_t ready;
+	/* owned by the simulation and by the renderer */
+	int back, front;
+	struct sim_input queue[SIM_QUEUE];
+	SDL_atomic_t head, tail;
+	Uint64 freq, period, due;
+	/* steps taken */
+	unsigned long step;
+	/* applied inputs are written to record, if not NULL; with replay,
+	 * those are applied instead of the queue */
+	FILE *record;
+	struct sim_record *replay;
+	size_t nreplay, ireplay;
+	SDL_atomic_t quit;
+	SDL_Thread *thread;
+};
+
+int sim_init(struct sim*, struct cgl*);
+int sim_start(struct sim*);
+int sim_record(struct sim*, const char*);
+int sim_replay(struct sim*, const char*);
+int sim_push(struct sim*, const struct sim_input*);
+Uint64 sim_event_time(const struct sim*, Uint32);
+void sim_update(struct sim*);
+void sim_run(struct sim*, int);
+const struct sim_frame *sim_acquire(struct sim*);
+double sim_alpha(const struct sim*, const struct sim_frame*);
+void sim_free(struct sim*);
+
+#endif
@@ -0,0 +1,195 @@
+/* soft.c - software renderer of draw lists into memory
+ * Copyright (C) 2010 Michal Trybus.
+ *
+ * This file is part of FreeCG.
+ *
+ * FreeCG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeCG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeCG. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "soft.h"
+#include "mathgeom.h"
+#include <math.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* the alpha byte of an RGBA pixel read as a Uint32 */
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+#define ALPHA_BITS 0xff000000u
+#else
+#define ALPHA_BITS 0x000000ffu
+#endif
+/* vertices are snapped to 1/SUBPIXEL of a pixel, as by the GL rasterizer */
+#define SUBPIXEL 256
+
+void soft_resize(struct soft_fb *fb, int w, int h)
+{
+	fb->w = w, fb->h = h;
+	fb->pixels = realloc(fb->pixels, w * h * 4);
+	fb->cols = realloc(fb->cols, w * sizeof(*fb->cols));
+}
+
+void soft_clear(struct soft_fb *fb, const Uint8 color[4])
+{
+	size_t row = fb->w * 4;
+	for (int i = 0; i < fb->w; ++i)
+		memcpy(fb->pixels + 4 * i, color, 4);
+	for (int j = 1; j < fb->h; ++j)
+		memcpy(fb->pixels + j * row, fb->pixels, row);
+}
+
+/* x * y / 255 rounded, the product of 8-bit normalized values */
+static inline int mul255(int x, int y)
+{
+	int p = x * y + 128;
+	return (p + (p >> 8)) >> 8;
+}
+/* Texel t with opacity a over pixel d, as glBlendFunc(GL_SRC_ALPHA,
+ * GL_ONE_MINUS_SRC_ALPHA) with 8-bit channels */
+static inline void blend(Uint8 *d, const Uint8 *t, float a)
+{
+	int sa = t[3] * a + 0.5f;
+	for (int c = 0; c < 3; ++c)
+		d[c] = min(255, mul255(t[c], sa) + mul255(d[c], 255 - sa));
+	d[3] = min(255, mul255(sa, sa) + mul255(d[3], 255 - sa));
+}
+/* n pixels of a row, showing the texels cols of the texture row src */
+static void span_c(Uint8 *d, const Uint32 *src, const int *cols, int n,
+		float a)
+{
+	for (int i = 0; i < n; ++i) {
+		const Uint8 *t = (const Uint8*)&src[cols[i]];
+		if (t[3] == 255 && a == 1)
+			memcpy(d + 4 * i, t, 4);
+		else if (t[3])
+			blend(d + 4 * i, t, a);
+	}
+}
+/* The tileset is alpha-keyed, so opaque sprites are drawn four pixels at
+ * a time by masking; texels with partial alpha are blended one by one.
+ * Unless scaled, the columns are consecutive and read as they are. */
+static void span(Uint8 *d, const Uint32 *src, const int *cols, int n,
+		float a, int consecutive)
+{
+	int i = 0;
+#ifdef __SSE2__
+	if (a == 1) {
+		const __m128i amask = _mm_set1_epi32(ALPHA_BITS),
+		              zero = _mm_setzero_si128();
+		for (; i + 4 <= n; i += 4) {
+			__m128i t = consecutive ?
+				_mm_loadu_si128((const __m128i*)(src + cols[i])) :
+				_mm_set_epi32(src[cols[i + 3]], src[cols[i + 2]],
+						src[cols[i + 1]], src[cols[i]]);
+			__m128i ta = _mm_and_si128(t, amask),
+				opaque = _mm_cmpeq_epi32(ta, amask),
+				keyed = _mm_or_si128(opaque,
+						_mm_cmpeq_epi32(ta, zero));
+			if (_mm_movemask_epi8(keyed) != 0xffff) {
+				span_c(d + 4 * i, src, cols + i, 4, a);
+				continue;
+			}
+			if (!_mm_movemask_epi8(opaque))
+				continue;
+			__m128i dst = _mm_loadu_si128((__m128i*)(d + 4 * i));
+			dst = _mm_or_si128(_mm_and_si128(opaque, t),
+					_mm_andnot_si128(opaque, dst));
+			_mm_storeu_si128((__m128i*)(d + 4 * i), dst);
+		}
+	}
+#else
+	(void)consecutive;
+#endif
+	span_c(d + 4 * i, src, cols + i, n - i, a);
+}
+
+static inline double snap(double x)
+{
+	return round(x * SUBPIXEL) / SUBPIXEL;
+}
+/* Pixels whose centres are in the rectangle are drawn, with texels picked
+ * at the centres. As by GL, coverage is decided with the corners snapped
+ * to the subpixel grid, including centres on the left and bottom edges (its
+ * window y goes up), while texture coordinates are interpolated between
+ * the exact corners. */
+static void soft_sprite(struct soft_fb *fb, const struct draw_pass *p,
+		const struct draw_rec *r)
+{
+	const struct texmgr *tm = r->tm;
+	double sx = fb->w / p->view.w,
+	       sy = fb->h / p->view.h,
+	       x0 = (r->x - p->view.x) * sx,
+	       y0 = (r->y - p->view.y) * sy,
+	       x1 = (r->x + r->w - p->view.x) * sx,
+	       y1 = (r->y + r->h - p->view.y) * sy;
+	if (!tm->pixels)
+		return;
+	int i0 = max(0, (int)ceil(snap(x0) - 0.5)),
+	    j0 = max(0, (int)floor(snap(y0) - 0.5) + 1),
+	    i1 = min(fb->w, (int)ceil(snap(x1) - 0.5)),
+	    j1 = min(fb->h, (int)floor(snap(y1) - 0.5) + 1);
+	if (i0 >= i1 || j0 >= j1)
+		return;
+	for (int i = i0; i < i1; ++i) {
+		int u = floor((i + 0.5 - x0) / (x1 - x0) * r->tex_w);
+		fb->cols[i - i0] = max(0, min((int)tm->w - 1,
+					tm->x + r->tex_x + u));
+	}
+	int consecutive = fb->cols[i1 - i0 - 1] - fb->cols[0] == i1 - i0 - 1;
+	for (int j = j0; j < j1; ++j) {
+		int v = floor((j + 0.5 - y0) / (y1 - y0) * r->tex_h);
+		v = max(0, min((int)tm->h - 1, tm->y + r->tex_y + v));
+		span(fb->pixels + 4 * (j * fb->w + i0),
+				(const Uint32*)tm->pixels + v * (int)tm->w,
+				fb->cols, i1 - i0, r->a, consecutive);
+	}
+}
+
+void soft_submit(struct soft_fb *fb, const struct drawlist *dl)
+{
+	for (size_t p = 0; p < dl->npasses; ++p) {
+		const struct draw_pass *pass = &dl->passes[p];
+		if (pass->kind != PassSprites)
+			continue;
+		for (size_t k = 0; k < pass->count; ++k)
+			soft_sprite(fb, pass, &dl->recs[pass->first + k]);
+	}
+}
+
+/* Copies the buffer to the surface of the window, which must not have a GL
+ * context */
+int soft_present(const struct soft_fb *fb, SDL_Window *window)
+{
+	SDL_Surface *dst = SDL_GetWindowSurface(window);
+	if (!dst)
+		return -1;
+	SDL_Surface *src = SDL_CreateRGBSurfaceWithFormatFrom(fb->pixels,
+			fb->w, fb->h, 32, fb->w * 4, SDL_PIXELFORMAT_RGBA32);
+	if (!src)
+		return -1;
+	SDL_SetSurfaceBlendMode(src, SDL_BLENDMODE_NONE);
+	int ret = SDL_BlitSurface(src, NULL, dst, NULL);
+	SDL_FreeSurface(src);
+	if (ret < 0)
+		return -1;
+	return SDL_UpdateWindowSurface(window);
+}
+
+void soft_free(struct soft_fb *fb)
+{
+	free(fb->pixels);
+	free(fb->cols);
+	memset(fb, 0, sizeof(*fb));
+}
@@ -0,0 +1,47 @@
+/* soft.h - software renderer of draw lists into memory
+ * Copyright (C) 2010 Michal Trybus.
+ *
+ * This file is part of FreeCG.
+ *
+ * FreeCG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeCG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeCG. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SOFT_H
+#define SOFT_H
+
+#include "drawlist.h"
+#include <SDL2/SDL.h>
+
+/*
+ * Draws the sprite passes of a draw list into an RGBA buffer, without GL,
+ * the way the fixed-function renderer does: nearest texels and alpha
+ * blending, in the order of the list. Textures have to be kept in memory
+ * (tm_in_memory), and no tiles may be in vertex buffers, as the other
+ * passes are skipped.
+ */
+struct soft_fb {
+	int w, h;
+	/* RGBA bytes, rows from the top */
+	Uint8 *pixels;
+	/* texture columns of the sprite being drawn */
+	int *cols;
+};
+
+void soft_resize(struct soft_fb*, int, int);
+void soft_clear(struct soft_fb*, const Uint8[4]);
+void soft_submit(struct soft_fb*, const struct drawlist*);
+int soft_present(const struct soft_fb*, SDL_Window*);
+void soft_free(struct soft_fb*);
+
+#endif
@@ -19,11 +19,31 @@
 
 #include "texmgr.h"
 #include "gfx.h"
+#include "trace.h"
 #include <math.h>
+#include <string.h>
 
-struct texmgr *tm_request_texture(const SDL_Surface *image)
+int tm_in_memory;
+
+/* Uploads the image, or copies it to *pixels if tm_in_memory */
+static GLuint tm_store(SDL_Surface *image, Uint8 **pixels)
 {
 	extern GLuint tm_load_texture(SDL_Surface*);
+	static GLuint nstored;
+	*pixels = NULL;
+	if (!tm_in_memory)
+		return tm_load_texture(image);
+	*pixels = malloc(image->w * image->h * 4);
+	for (int y = 0; y < image->h; ++y)
+		memcpy(*pixels + y * image->w * 4,
+				(Uint8*)image->pixels + y * image->pitch,
+				image->w * 4);
+	return ++nstored;
+}
+
+struct texmgr *tm_request_texture(const SDL_Surface *image)
+{
+	Uint64 t = trace_begin();
 	struct texmgr *texm = calloc(1, sizeof(*texm));
 	texm->w = 1 << (int)ceil(log2(image->w));
 	texm->h = 1 << (int)ceil(log2(image->h));
@@ -48,15 +68,76 @@ struct texmgr *tm_request_texture(const SDL_Surface *image)
 	// SDL_BlitSurface reste inchangé
 	SDL_BlitSurface((SDL_Surface*)image, &rect, tile, NULL);
 	
-	texm->texno = tm_load_texture(tile);
+	texm->texno = tm_store(tile, &texm->pixels);
 	
 	if (SDL_MUSTLOCK(tile))
 		SDL_UnlockSurface(tile);
 	
 	SDL_FreeSurface(tile);
+	trace_end("tm_request_texture", t);
 	return texm;
 }
 
+/* Packs the images into one texture, in rows of images sorted by height, so
+ * that everything can be drawn without switching textures. out[i] receives
+ * image i. */
+void tm_request_atlas(SDL_Surface *images[], size_t n, struct texmgr *out[])
+{
+	Uint64 t = trace_begin();
+	size_t order[n];
+	int w = 0;
+	for (size_t i = 0; i < n; ++i) {
+		size_t j = i;
+		for (; j > 0 && images[order[j-1]]->h < images[i]->h; --j)
+			order[j] = order[j-1];
+		order[j] = i;
+		if (images[i]->w > w)
+			w = images[i]->w;
+	}
+	w = 1 << (int)ceil(log2(w));
+	int x = 0, y = 0, row_h = 0;
+	for (size_t k = 0; k < n; ++k) {
+		SDL_Surface *img = images[order[k]];
+		if (x > 0 && x + img->w > w) {
+			x = 0;
+			y += row_h + ATLAS_GAP;
+			row_h = 0;
+		}
+		out[order[k]] = calloc(1, sizeof(**out));
+		out[order[k]]->x = x;
+		out[order[k]]->y = y;
+		x += img->w + ATLAS_GAP;
+		if (img->h > row_h)
+			row_h = img->h;
+	}
+	int h = 1 << (int)ceil(log2(y + row_h));
+	SDL_Surface *atlas = SDL_CreateRGBSurface(0, w, h, 32,
+			RMASK, GMASK, BMASK, AMASK);
+	SDL_SetSurfaceBlendMode(atlas, SDL_BLENDMODE_NONE);
+	for (size_t i = 0; i < n; ++i) {
+		SDL_Rect dst = {
+			.x = out[i]->x,
+			.y = out[i]->y,
+			.w = images[i]->w,
+			.h = images[i]->h
+		};
+		SDL_BlitSurface(images[i], NULL, atlas, &dst);
+	}
+	if (SDL_MUSTLOCK(atlas))
+		SDL_LockSurface(atlas);
+	Uint8 *pixels;
+	GLuint texno = tm_store(atlas, &pixels);
+	if (SDL_MUSTLOCK(atlas))
+		SDL_UnlockSurface(atlas);
+	SDL_FreeSurface(atlas);
+	for (size_t i = 0; i < n; ++i) {
+		out[i]->w = w, out[i]->h = h;
+		out[i]->texno = texno;
+		out[i]->pixels = pixels;
+	}
+	trace_end("tm_request_atlas", t);
+}
+
 GLuint tm_load_texture(SDL_Surface *image)
 {
 	GLuint texno;
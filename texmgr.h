@@ -23,33 +23,49 @@
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_opengl.h>
 
+/* An image in a texture, possibly shared with other images (see
+ * tm_request_atlas); coordinates passed to tm_coord_* are relative to it */
 struct texmgr {
+	/* size of the whole texture */
 	double w, h;
 	GLuint texno;
+	/* origin of the image in the texture */
+	int x, y;
+	/* RGBA bytes of the whole texture if tm_in_memory, NULL otherwise */
+	Uint8 *pixels;
+};
+enum texmgr_config {
+	/* empty pixels between images of an atlas */
+	ATLAS_GAP = 2
 };
 
 static inline void tm_coord_tl(struct texmgr *tm, int x, int y,
 		__attribute__((unused)) int w, __attribute__((unused)) int h)
 {
-	glTexCoord2f((double)x / tm->w,
-			(double)y / tm->h);
+	glTexCoord2f((double)(tm->x + x) / tm->w,
+			(double)(tm->y + y) / tm->h);
 }
 static inline void tm_coord_bl(struct texmgr *tm, int x, int y, __attribute__((unused)) int w, int h)
 {
-	glTexCoord2f((double)x / tm->w,
-			(double)(y + h) / tm->h);
+	glTexCoord2f((double)(tm->x + x) / tm->w,
+			(double)(tm->y + y + h) / tm->h);
 }
 static inline void tm_coord_br(struct texmgr *tm, int x, int y, int w, int h)
 {
-	glTexCoord2f((double)(x + w) / tm->w,
-			(double)(y + h) / tm->h);
+	glTexCoord2f((double)(tm->x + x + w) / tm->w,
+			(double)(tm->y + y + h) / tm->h);
 }
 static inline void tm_coord_tr(struct texmgr *tm, int x, int y, int w, __attribute__((unused)) int h)
 {
-	glTexCoord2f((double)(x + w) / tm->w,
-			(double)y / tm->h);
+	glTexCoord2f((double)(tm->x + x + w) / tm->w,
+			(double)(tm->y + y) / tm->h);
 }
 
+/* Images are kept in memory for the software renderer (see soft.h) instead of
+ * being uploaded to GL; texno then only tells the textures apart */
+extern int tm_in_memory;
+
 struct texmgr *tm_request_texture(const SDL_Surface*);
+void tm_request_atlas(SDL_Surface*[], size_t, struct texmgr*[]);
 
 #endif
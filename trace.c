@@ -0,0 +1,179 @@
+/* trace.c - spans of time in the Chrome trace format
+ * Copyright (C) 2010 Michal Trybus.
+ *
+ * This file is part of FreeCG.
+ *
+ * FreeCG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeCG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeCG. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct trace_span {
+	const char *name;
+	Uint64 start, end;
+};
+/* Written by its thread, read by trace_flush, under lock */
+struct trace_ring {
+	const char *thread;
+	SDL_SpinLock lock;
+	struct trace_span *spans;
+	size_t next, count;
+};
+
+int trace_on;
+static struct {
+	const char *file;
+	Uint64 origin;
+	SDL_TLSID tls;
+	struct trace_ring rings[TRACE_THREADS];
+	SDL_atomic_t nrings;
+} trace;
+
+/* Traces from now on, to be written to file; the calling thread is
+ * "main" */
+int trace_start(const char *file)
+{
+	trace.tls = SDL_TLSCreate();
+	if (!trace.tls)
+		return -1;
+	trace.file = file;
+	trace.origin = SDL_GetPerformanceCounter();
+	trace_on = 1;
+	trace_thread("main");
+	return 0;
+}
+
+/* The ring of the calling thread, set up on its first span; NULL if there
+ * are too many threads or no memory */
+static struct trace_ring *trace_ring(void)
+{
+	/* of threads not traced */
+	static struct trace_ring dropped;
+	struct trace_ring *r = SDL_TLSGet(trace.tls);
+	if (r)
+		return r != &dropped ? r : NULL;
+	int k = SDL_AtomicAdd(&trace.nrings, 1);
+	r = k < TRACE_THREADS ? &trace.rings[k] : &dropped;
+	if (r != &dropped) {
+		SDL_AtomicLock(&r->lock);
+		r->spans = malloc(TRACE_RING * sizeof(*r->spans));
+		SDL_AtomicUnlock(&r->lock);
+		if (!r->spans)
+			r = &dropped;
+	}
+	SDL_TLSSet(trace.tls, r, NULL);
+	return r != &dropped ? r : NULL;
+}
+
+/* Names the calling thread in the trace */
+void trace_thread(const char *name)
+{
+	struct trace_ring *r;
+	if (!trace_on || !(r = trace_ring()))
+		return;
+	SDL_AtomicLock(&r->lock);
+	r->thread = name;
+	SDL_AtomicUnlock(&r->lock);
+}
+
+/* A span from start to end, readings of the performance counter */
+void trace_span(const char *name, Uint64 start, Uint64 end)
+{
+	struct trace_ring *r = trace_ring();
+	if (!r)
+		return;
+	SDL_AtomicLock(&r->lock);
+	r->spans[r->next] = (struct trace_span){name, start, end};
+	r->next = (r->next + 1) % TRACE_RING;
+	if (r->count < TRACE_RING)
+		++r->count;
+	SDL_AtomicUnlock(&r->lock);
+}
+
+/* Writes what the rings hold now, replacing the file; the rings are
+ * copied under lock, so the threads wait only for that */
+int trace_flush(void)
+{
+	if (!trace_on)
+		return 0;
+	FILE *fp = fopen(trace.file, "w");
+	if (!fp) {
+		SDL_SetError("Cannot open %s", trace.file);
+		return -1;
+	}
+	struct trace_span *copy = malloc(TRACE_RING * sizeof(*copy));
+	if (!copy) {
+		fclose(fp);
+		SDL_SetError("Out of memory");
+		return -1;
+	}
+	double us = 1e6 / SDL_GetPerformanceFrequency();
+	int n = SDL_AtomicGet(&trace.nrings);
+	const char *sep = "";
+	fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+	for (int k = 0; k < n && k < TRACE_THREADS; ++k) {
+		struct trace_ring *r = &trace.rings[k];
+		SDL_AtomicLock(&r->lock);
+		const char *thread = r->thread;
+		size_t count = r->count,
+		       first = (r->next + TRACE_RING - count) % TRACE_RING;
+		for (size_t i = 0; i < count && r->spans; ++i)
+			copy[i] = r->spans[(first + i) % TRACE_RING];
+		if (!r->spans)
+			count = 0;
+		SDL_AtomicUnlock(&r->lock);
+		if (thread) {
+			fprintf(fp, "%s{\"name\": \"thread_name\", \"ph\": \"M\", "
+					"\"pid\": 1, \"tid\": %d, "
+					"\"args\": {\"name\": \"%s\"}}",
+					sep, k + 1, thread);
+			sep = ",\n";
+		}
+		for (size_t i = 0; i < count; ++i) {
+			const struct trace_span *s = &copy[i];
+			fprintf(fp, "%s{\"name\": \"%s\", \"ph\": \"X\", "
+					"\"pid\": 1, \"tid\": %d, "
+					"\"ts\": %.3f, \"dur\": %.3f}",
+					sep, s->name, k + 1,
+					(Sint64)(s->start - trace.origin) * us,
+					(double)(s->end - s->start) * us);
+			sep = ",\n";
+		}
+	}
+	fprintf(fp, "\n]}\n");
+	free(copy);
+	int err = ferror(fp);
+	err |= fclose(fp) != 0;
+	if (err) {
+		SDL_SetError("Cannot write %s", trace.file);
+		return -1;
+	}
+	return 0;
+}
+
+/* Flushes and stops tracing; the other threads must have stopped */
+void trace_stop(void)
+{
+	if (!trace_on)
+		return;
+	if (trace_flush() < 0)
+		fprintf(stderr, "trace_flush: %s\n", SDL_GetError());
+	trace_on = 0;
+	for (int k = 0; k < TRACE_THREADS; ++k)
+		free(trace.rings[k].spans);
+	memset(&trace, 0, sizeof(trace));
+}
@@ -0,0 +1,60 @@
+/* trace.h - spans of time in the Chrome trace format
+ * Copyright (C) 2010 Michal Trybus.
+ *
+ * This file is part of FreeCG.
+ *
+ * FreeCG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeCG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeCG. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <SDL2/SDL.h>
+
+/*
+ * Once trace_start is called, spans of time -- loading, the phases of
+ * frames and steps (see prof.h) -- are kept in a ring per thread, the
+ * oldest overwritten when it is full, and written out by trace_flush as
+ * JSON of the Chrome trace event format, for chrome://tracing or Perfetto.
+ * Until then a span costs a test of trace_on.
+ *
+ * Names of spans are kept by pointer, so they must be string constants.
+ */
+enum trace_config {
+	/* spans kept per thread */
+	TRACE_RING = 1 << 16,
+	/* threads traced at most; spans of others are dropped */
+	TRACE_THREADS = 8
+};
+
+extern int trace_on;
+
+int trace_start(const char*);
+void trace_thread(const char*);
+void trace_span(const char*, Uint64, Uint64);
+int trace_flush(void);
+void trace_stop(void);
+
+/* Traces a span: t = trace_begin(); ...; trace_end(name, t) */
+static inline Uint64 trace_begin(void)
+{
+	return trace_on ? SDL_GetPerformanceCounter() : 0;
+}
+static inline void trace_end(const char *name, Uint64 start)
+{
+	if (trace_on)
+		trace_span(name, start, SDL_GetPerformanceCounter());
+}
+
+#endif